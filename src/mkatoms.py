@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Generates vformat_atoms_gen.h from vformat_atoms.list.
+#
+# The lookup table is a two level perfect hash: the FNV-1a hash of the
+# upper-cased name selects a displacement by its top byte, and the
+# displaced hash picks the table slot.  Each slot holds at most one name,
+# so a lookup is one hash, one table probe and one string compare.
+#
+# usage: mkatoms.py vformat_atoms.list > vformat_atoms_gen.h
+
+import sys
+
+TABLE_SIZE = 256
+N_DISPLACE = 64
+
+def fnv(name, seed):
+	h = seed
+	for c in name.upper().encode('ascii'):
+		h = ((h ^ c) * 16777619) & 0xffffffff
+	return h
+
+def build(names, seed):
+	buckets = {}
+	for name in names:
+		h = fnv(name, seed)
+		buckets.setdefault((h >> 24) % N_DISPLACE, []).append((name, h))
+	table = [None] * TABLE_SIZE
+	displace = [0] * N_DISPLACE
+	for b, members in sorted(buckets.items(), key = lambda kv: -len(kv[1])):
+		for d in range(TABLE_SIZE):
+			slots = [(h + d) & (TABLE_SIZE - 1) for name, h in members]
+			if len(set(slots)) == len(slots) and all(table[s] is None for s in slots):
+				for (name, h), s in zip(members, slots):
+					table[s] = name
+				displace[b] = d
+				break
+		else:
+			return None
+	return table, displace
+
+def main():
+	names = []
+	for line in open(sys.argv[1]):
+		line = line.strip()
+		if line and not line.startswith('#') and line not in names:
+			names.append(line)
+
+	seed = 0x811c9dc5
+	while True:
+		result = build(names, seed)
+		if result:
+			break
+		seed += 1
+	table, displace = result
+
+	ident = lambda name: 'VF_ATOM_' + name.replace('-', '_')
+
+	out = sys.stdout
+	out.write('/* generated by mkatoms.py from vformat_atoms.list, do not edit */\n\n')
+	out.write('#ifndef VFORMAT_ATOMS_GEN_H\n#define VFORMAT_ATOMS_GEN_H\n\n')
+	out.write('typedef enum {\n\tVF_ATOM_UNKNOWN = 0,\n')
+	for name in names:
+		out.write('\t%s,\n' % ident(name))
+	out.write('\tVF_ATOM_N_KNOWN\n} VFormatAtom;\n\n')
+	out.write('#endif /* VFORMAT_ATOMS_GEN_H */\n\n')
+
+	out.write('#ifdef VFORMAT_ATOMS_TABLE\n\n')
+	out.write('#define VF_ATOM_HASH_SEED  0x%08xU\n' % seed)
+	out.write('#define VF_ATOM_TABLE_SIZE %d\n' % TABLE_SIZE)
+	out.write('#define VF_ATOM_N_DISPLACE %d\n\n' % N_DISPLACE)
+	out.write('static const guint8 vformat_atom_displace[VF_ATOM_N_DISPLACE] = {\n')
+	for i in range(0, N_DISPLACE, 16):
+		out.write('\t' + ', '.join('%d' % d for d in displace[i:i + 16]) + ',\n')
+	out.write('};\n\n')
+	out.write('static const struct {\n\tconst char *name;\n\tVFormatAtom atom;\n} vformat_atom_table[VF_ATOM_TABLE_SIZE] = {\n')
+	for i, name in enumerate(table):
+		if name:
+			out.write('\t[%d] = { "%s", %s },\n' % (i, name, ident(name)))
+	out.write('};\n\n')
+	out.write('static const char *const vformat_atom_names[VF_ATOM_N_KNOWN] = {\n\tNULL,\n')
+	for name in names:
+		out.write('\t"%s",\n' % name)
+	out.write('};\n\n')
+	out.write('#endif /* VFORMAT_ATOMS_TABLE */\n')
+
+main()
@@ -43,34 +43,167 @@
 #include <errno.h>
 
 #include "vformat.h"
+#include "opensync_index.h"
 #include "opensync_prefs.h"
 
 #define BUFFSIZE 8192
 
+/* The email addresses of a person that is updated from a vCard.  The
+ * new list is built from the old addresses the vCard still has, looked
+ * up by their address, and new ones.  The person keeps its list until
+ * the merge is finished. */
+typedef struct
+{
+	GList *saved;      /* copy of the old list, NULL where reused */
+	GHashTable *index; /* chomped address -> GQueue of links into saved */
+	GList *emails;     /* the new email list, in reverse order */
+	GList *created;    /* ItemEMails in emails that are new */
+} EmailMerge;
+
+/* The synced fields of an incoming vCard, collected in one pass before
+ * they are compared with an ItemPerson.  Fields the vCard does not have
+ * are NULL and leave the person's ones alone. */
+typedef struct
+{
+	const gchar *last_name;
+	const gchar *first_name;
+	gchar *common_name;
+	const gchar *nick_name;
+	gint numEmail; /* internet addresses in emails */
+	EmailMerge emails;
+	const gchar *birthday;
+	const gchar *notes;
+	GPtrArray *attribs; /* name, value pairs of X-CLAWS-ATTRIBUTE, or NULL */
+	GPtrArray *categories; /* stripped values of CATEGORIES, or NULL */
+} PersonUpdate;
+
+/* A part of the address book that contacts are synced from: a whole
+ * data source, or a folder of an address book given by the IDs of the
+ * folders on the way down. */
+typedef struct
+{
+	AddressDataSource *ds;
+	gchar **folder_ids; /* NULL for the whole data source */
+} SyncScopeEntry;
+
+typedef gint (*PersonFunc)(ItemPerson*, AddressDataSource*);
+
+/* A contact waiting for its turn in an export.  It is looked up again
+ * then, as the data sources may have been edited, re-read or removed. */
 typedef struct
 {
-	ItemPerson *person;
 	AddressDataSource *ds;
-} ContactHashVal;
+	gchar *uid;
+} PendingContact;
 
-static gchar*   vcard_get_from_ItemPerson(ItemPerson*);
-static void     update_ItemPerson_from_vcard(AddressBookFile*, ItemPerson*, gchar*);
+/* An export of contacts or events.  It runs from an idle source and
+ * sends the items in slices of about EXPORT_SLICE_MSEC, so that big
+ * address books and calendars do not hold up the GUI.  The requests of
+ * the session are not read until it is done. */
+typedef struct
+{
+	GPtrArray *items;
+	guint next;
+	gboolean (*send_item)(gpointer); /* FALSE if the socket failed */
+	GDestroyNotify free_item;
+	const gchar *what;
+} Export;
+
+#define EXPORT_SLICE_MSEC 2
+
+/* How a vCard property maps to ItemPerson fields.  export_field adds
+ * the person's properties to a vCard, import_field collects one property
+ * of an incoming vCard. */
+typedef struct
+{
+	VFormatAtom atom;
+	void (*export_field)(VFormat*, ItemPerson*);
+	void (*import_field)(PersonUpdate*, VFormatAttribute*);
+} PersonFieldMap;
+
+/* user attributes that have a vCard property of their own */
+#define ATTRIB_BIRTHDAY "Birthday"
+#define ATTRIB_NOTES    "Notes"
+
+static gboolean str_equal_null(const gchar*, const gchar*);
+static gchar*   vcard_get_from_ItemPerson(ItemPerson*, AddressDataSource*);
+static gboolean update_ItemPerson_from_vcard(AddressDataSource*, ItemPerson*,
+																						 VFormat*, gboolean);
+static const PersonFieldMap* person_field_lookup(VFormatAtom);
+static UserAttribute* attrib_new(const gchar*, const gchar*);
+static gboolean person_update_attribs(PersonUpdate*, AddressBookFile*,
+																			ItemPerson*, gboolean);
+static gboolean person_update_groups(PersonUpdate*, AddressDataSource*,
+																		 ItemPerson*, GSList*, gboolean);
+static gboolean person_in_group(ItemPerson*, ItemGroup*);
+
+static void uid_export(VFormat*, ItemPerson*);
+static void name_export(VFormat*, ItemPerson*);
+static void name_import(PersonUpdate*, VFormatAttribute*);
+static void display_name_export(VFormat*, ItemPerson*);
+static void display_name_import(PersonUpdate*, VFormatAttribute*);
+static void nick_name_export(VFormat*, ItemPerson*);
+static void nick_name_import(PersonUpdate*, VFormatAttribute*);
+static void email_export(VFormat*, ItemPerson*);
+static void email_import(PersonUpdate*, VFormatAttribute*);
+static gboolean email_attribute_is_internet(VFormatAttribute*);
+static void birthday_import(PersonUpdate*, VFormatAttribute*);
+static void notes_import(PersonUpdate*, VFormatAttribute*);
+static void attribs_export(VFormat*, ItemPerson*);
+static void attribs_import(PersonUpdate*, VFormatAttribute*);
+static void categories_export(VFormat*, ItemPerson*, AddressDataSource*);
+static void categories_import(PersonUpdate*, VFormatAttribute*);
+static gint group_name_compare(gconstpointer, gconstpointer);
 
 static char*    sock_get_next_line(int);
 static gchar*   opensync_get_socket_name(void);
 static gint     create_unix_socket(void);
 static gint     uxsock_remove(void);
 static gboolean listen_channel_input_cb(GIOChannel*, GIOCondition, gpointer);
+static gboolean answer_channel_input_cb(GIOChannel*, GIOCondition, gpointer);
+static void     session_watch_requests(void);
+static void     session_close(void);
+
+static void     export_start(GPtrArray*, gboolean (*)(gpointer), GDestroyNotify,
+												 const gchar*);
+static gboolean export_slice(gpointer);
+static void     export_free(Export*);
 
 static void   received_finished_notification(gint);
 
 static void   received_contacts_request(gint);
+static gint   contact_export_add(ItemPerson*, AddressDataSource*);
+static gboolean contact_export_send(gpointer);
+static void   pending_contact_free(PendingContact*);
+static GPtrArray* sync_scope_get(void);
+static void   sync_scope_free(GPtrArray*);
+static ItemFolder* sync_scope_find_folder(SyncScopeEntry*);
+static gboolean sync_scope_resolves(GPtrArray*);
+static void   load_address_books(GPtrArray*);
+static void   sync_scope_foreach_person(GPtrArray*, PersonFunc);
+static void   folder_foreach_person(ItemFolder*, AddressDataSource*, PersonFunc);
+static void   contact_index_build(void);
+static void   contact_index_add_book(AddressDataSource*);
+static gint   contact_index_add(ItemPerson*, AddressDataSource*);
+static ItemPerson* find_duplicate_contact(VFormat*, AddressDataSource**);
+static gboolean send_contact(gint, ItemPerson*, AddressDataSource*);
 static void   received_contact_modify_request(gint);
 static void   received_contact_delete_request(gint);
 static void   received_contact_add_request(gint);
-static gchar* get_next_contact(void);
+static void   received_contacts_add_request(gint);
+static void   received_find_contact_by_email_request(gint, const gchar*);
+static void   received_search_contacts_request(gint, const gchar*);
+static gboolean get_folder_for_new_contacts(AddressDataSource**, ItemFolder**);
+static void   forget_folder_for_new_contacts(void);
+static gboolean address_book_has_folder(AddressDataSource*, ItemFolder*);
+static gboolean folder_contains(ItemFolder*, ItemFolder*);
+static ItemPerson* add_contact_from_vformat(AddressDataSource*, ItemFolder*,
+																						VFormat*);
+static VFormat* get_next_contact(void);
 
 static void   received_events_request(gint);
+static gboolean event_export_add(const gchar*);
+static gboolean event_export_send(gpointer);
 static void   received_event_modify_request(gint);
 static void   received_event_delete_request(gint);
 static void   received_event_add_request(gint);
@@ -79,18 +212,55 @@ static gchar* get_next_event(void);
 static gboolean sock_send(int, const char*);
 
 static gint addrbook_entry_send(ItemPerson*, AddressDataSource *ds);
+static void contact_hash_add(ItemPerson*, AddressDataSource*);
+static ItemPerson* contact_hash_lookup(const gchar*, AddressDataSource**);
 
-static GList* restore_or_add_email_address(AddressBookFile*, ItemPerson*,
-																					 GList*, const gchar*);
+static void email_merge_begin(EmailMerge*, ItemPerson*);
+static void email_merge_add(EmailMerge*, const gchar*);
+static gboolean email_merge_finish(EmailMerge*, AddressBookFile*, ItemPerson*,
+																	 GSList*, gboolean, gboolean);
 static gboolean event_send_cb(const gchar*);
 
 static gint uxsock = -1;
 static gint answer_sock = -1;
 static GIOChannel *listen_channel= NULL;
 guint listen_source_id;
+static guint answer_source_id = 0;
+static guint export_source_id = 0;
+
+/* the items of an export while they are collected */
+static GPtrArray *export_items = NULL;
+/* "ds/UID" of the contacts in export_items, as a folder in the sync
+   scope may be inside a book that is, too */
+static GHashTable *export_contact_keys = NULL;
 
 static GHashTable *contact_hash= NULL;
 
+/* the data sources in the contact index as a whole */
+static GSList *contact_index_books = NULL;
+
+/* where new contacts go in this sync session, and how that was chosen */
+static AddressDataSource *new_contacts_book = NULL;
+static ItemFolder *new_contacts_folder = NULL;
+static gchar *new_contacts_path = NULL;
+static OpenSyncAddressBookChoice new_contacts_choice;
+
+/* Exported in this order.  The user attributes, including Birthday and
+ * Notes, are exported in one go by the X-CLAWS-ATTRIBUTE entry.  The
+ * groups need the person's address book and are exported as CATEGORIES
+ * after the table. */
+static const PersonFieldMap person_fields[] = {
+	{ VF_ATOM_UID,               uid_export,          NULL },
+	{ VF_ATOM_N,                 name_export,         name_import },
+	{ VF_ATOM_FN,                display_name_export, display_name_import },
+	{ VF_ATOM_NICKNAME,          nick_name_export,    nick_name_import },
+	{ VF_ATOM_EMAIL,             email_export,        email_import },
+	{ VF_ATOM_BDAY,              NULL,                birthday_import },
+	{ VF_ATOM_NOTE,              NULL,                notes_import },
+	{ VF_ATOM_X_CLAWS_ATTRIBUTE, attribs_export,      attribs_import },
+	{ VF_ATOM_CATEGORIES,        NULL,                categories_import },
+};
+
 void opensync_init(void)
 {
 	/* created unix socket to listen on */
@@ -99,14 +269,18 @@ void opensync_init(void)
 		g_print("failed to create unix socket for opensync\n");
 		return;
 	}
+	/* kept, the watch is removed during sync sessions */
 	listen_channel = g_io_channel_unix_new(uxsock);
 	listen_source_id = g_io_add_watch(listen_channel, G_IO_IN, listen_channel_input_cb, NULL);
-	g_io_channel_unref(listen_channel);
 }
 
 void opensync_done(void)
 {
 	GError *error= NULL;
+
+	if (answer_sock != -1)
+		session_close();
+
 	if (listen_channel) {
 		g_io_channel_shutdown(listen_channel, TRUE, &error);
 		if (error) {
@@ -115,6 +289,8 @@ void opensync_done(void)
 		}
 		if(listen_source_id)
 			g_source_remove(listen_source_id);
+		g_io_channel_unref(listen_channel);
+		listen_channel = NULL;
 	}
 
 	uxsock_remove();
@@ -135,82 +311,519 @@ static gboolean sock_send(int fd, const char *msg)
 
 static void received_finished_notification(gint answer_sock)
 {
-	/* cleanup */
-	if (contact_hash) {
-		g_hash_table_destroy(contact_hash);
-		contact_hash = NULL;
-	}
-
 	/* GUI update */
 	vcalendar_refresh_folder_contents();
 }
 
 static void received_contacts_request(gint fd)
 {
+	GPtrArray *scope;
+
 	g_print("Sending contacts\n");
-	addrindex_load_person_ds(addrbook_entry_send);
-	sock_send(answer_sock, ":done:\n");
-	g_print("Sending of contacts done: %d\n",	g_hash_table_size(contact_hash));
+
+	/* only the address books in the sync scope are read */
+	scope = sync_scope_get();
+	if (scope)
+		load_address_books(scope);
+
+	/* an empty export would make the client delete every contact */
+	if (!scope || (scope->len && !sync_scope_resolves(scope))) {
+		g_print("Error: sync scope matches no contacts folder\n");
+		if (scope)
+			sync_scope_free(scope);
+		sock_send(fd, ":failure:\n");
+		return;
+	}
+
+	export_items = g_ptr_array_new();
+	export_contact_keys = g_hash_table_new_full(g_str_hash, g_str_equal,
+																							g_free, NULL);
+	sync_scope_foreach_person(scope, contact_export_add);
+	sync_scope_free(scope);
+	g_hash_table_destroy(export_contact_keys);
+	export_contact_keys = NULL;
+
+	export_start(export_items, contact_export_send,
+							 (GDestroyNotify)pending_contact_free, "contacts");
+	export_items = NULL;
+}
+
+static gint contact_export_add(ItemPerson *person, AddressDataSource *ds)
+{
+	PendingContact *pending;
+	gchar *key;
+
+	key = g_strdup_printf("%p/%s", (void*)ds, ADDRITEM_ID(person));
+	if (g_hash_table_lookup(export_contact_keys, key)) {
+		g_free(key);
+		return 0;
+	}
+	g_hash_table_insert(export_contact_keys, key, key);
+
+	pending = g_new0(PendingContact, 1);
+	pending->ds = ds;
+	pending->uid = g_strdup(ADDRITEM_ID(person));
+	g_ptr_array_add(export_items, pending);
+
+	return 0;
+}
+
+static gboolean contact_export_send(gpointer data)
+{
+	PendingContact *pending = data;
+	ItemPerson *person;
+
+	person = opensync_data_source_get_person(pending->ds, pending->uid);
+	if (!person)
+		return TRUE;
+
+	return addrbook_entry_send(person, pending->ds) == 0;
+}
+
+static void pending_contact_free(PendingContact *pending)
+{
+	g_free(pending->uid);
+	g_free(pending);
+}
+
+static void export_start(GPtrArray *items, gboolean (*send_item)(gpointer),
+												 GDestroyNotify free_item, const gchar *what)
+{
+	Export *export;
+
+	export = g_new0(Export, 1);
+	export->items = items;
+	export->send_item = send_item;
+	export->free_item = free_item;
+	export->what = what;
+	export_source_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, export_slice,
+																		 export, (GDestroyNotify)export_free);
+}
+
+/* sends items for about EXPORT_SLICE_MSEC, at least one.  When all are
+   sent, the session goes on with the next request. */
+static gboolean export_slice(gpointer data)
+{
+	Export *export = data;
+	GTimer *timer;
+	gboolean sent = TRUE;
+
+	timer = g_timer_new();
+	while (sent && (export->next < export->items->len)) {
+		gpointer item;
+
+		item = g_ptr_array_index(export->items, export->next);
+		g_ptr_array_index(export->items, export->next) = NULL;
+		export->next++;
+		sent = export->send_item(item);
+		export->free_item(item);
+
+		if (g_timer_elapsed(timer, NULL) * 1000 >= EXPORT_SLICE_MSEC)
+			break;
+	}
+	g_timer_destroy(timer);
+
+	if (sent && (export->next < export->items->len))
+		return TRUE;
+
+	export_source_id = 0;
+	if (sent && sock_send(answer_sock, ":done:\n")) {
+		g_print("Sending of %s done: %d\n", export->what, export->items->len);
+		session_watch_requests();
+	}
+	else {
+		g_print("Sending of %s failed\n", export->what);
+		session_close();
+	}
+
+	return FALSE;
+}
+
+static void export_free(Export *export)
+{
+	guint i;
+
+	for (i = export->next; i < export->items->len; i++)
+		export->free_item(g_ptr_array_index(export->items, i));
+	g_ptr_array_free(export->items, TRUE);
+	g_free(export);
+}
+
+/* The parts of the address book in opensync_config.contact_sync_scope,
+ * a comma separated list of folder paths like the ones
+ * addressbook_folder_selection() returns.  If it is empty, every data
+ * source that is not queried externally is in the scope.  NULL if it is
+ * set but names no address book.  No address book is read for this. */
+static GPtrArray* sync_scope_get(void)
+{
+	GPtrArray *scope;
+	GList *nodeIf, *nodeDS;
+	gchar **paths = NULL;
+	gboolean configured = FALSE;
+	guint i;
+
+	if (opensync_config.contact_sync_scope)
+		paths = g_strsplit(opensync_config.contact_sync_scope, ",", 0);
+
+	scope = g_ptr_array_new();
+	for (i = 0; paths && paths[i]; i++) {
+		gchar **parts;
+
+		g_strstrip(paths[i]);
+		if (!*paths[i])
+			continue;
+		configured = TRUE;
+
+		/* the first part is the address book file name */
+		parts = g_strsplit(paths[i], "/", 0);
+		nodeIf = addrindex_get_interface_list(addrindex_get_object());
+		for (; nodeIf; nodeIf = nodeIf->next) {
+			AddressInterface *iface = nodeIf->data;
+
+			if (iface->type != ADDR_IF_BOOK)
+				continue;
+			for (nodeDS = iface->listSource; nodeDS; nodeDS = nodeDS->next) {
+				AddressDataSource *ds = nodeDS->data;
+				AddressBookFile *abf = ds->rawDataSource;
+
+				if (abf && abf->fileName && !strcmp(abf->fileName, parts[0])) {
+					SyncScopeEntry *entry;
+					entry = g_new0(SyncScopeEntry, 1);
+					entry->ds = ds;
+					if (parts[1] && *parts[1])
+						entry->folder_ids = g_strdupv(parts + 1);
+					g_ptr_array_add(scope, entry);
+				}
+			}
+		}
+		g_strfreev(parts);
+	}
+
+	g_strfreev(paths);
+
+	if (configured && !scope->len) {
+		g_warning("no address book in sync scope '%s'\n",
+							opensync_config.contact_sync_scope);
+		g_ptr_array_free(scope, TRUE);
+		return NULL;
+	}
+
+	if (!scope->len) {
+		nodeIf = addrindex_get_interface_list(addrindex_get_object());
+		for (; nodeIf; nodeIf = nodeIf->next) {
+			AddressInterface *iface = nodeIf->data;
+
+			if (!iface->useInterface || iface->externalQuery)
+				continue;
+			for (nodeDS = iface->listSource; nodeDS; nodeDS = nodeDS->next) {
+				SyncScopeEntry *entry;
+				entry = g_new0(SyncScopeEntry, 1);
+				entry->ds = nodeDS->data;
+				g_ptr_array_add(scope, entry);
+			}
+		}
+	}
+
+	return scope;
+}
+
+/* whether one of the entries of @scope is found, that is a whole data
+   source or a folder that still exists.  The books must be read. */
+static gboolean sync_scope_resolves(GPtrArray *scope)
+{
+	guint i;
+
+	for (i = 0; i < scope->len; i++) {
+		SyncScopeEntry *entry = g_ptr_array_index(scope, i);
+
+		if (!entry->folder_ids || sync_scope_find_folder(entry))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void sync_scope_free(GPtrArray *scope)
+{
+	guint i;
+
+	for (i = 0; i < scope->len; i++) {
+		SyncScopeEntry *entry = g_ptr_array_index(scope, i);
+		g_strfreev(entry->folder_ids);
+		g_free(entry);
+	}
+	g_ptr_array_free(scope, TRUE);
+}
+
+/* the folder of @entry.  The address book has to be read already. */
+static ItemFolder* sync_scope_find_folder(SyncScopeEntry *entry)
+{
+	ItemFolder *folder;
+	gchar **id;
+
+	folder = addrindex_ds_get_root_folder(entry->ds);
+	for (id = entry->folder_ids; folder && *id; id++) {
+		GList *walk;
+
+		for (walk = folder->listFolder; walk; walk = walk->next) {
+			if (str_equal_null(ADDRITEM_ID(walk->data), *id))
+				break;
+		}
+		folder = walk ? walk->data : NULL;
+	}
+	if (!folder)
+		g_warning("address book folder in sync scope not found\n");
+
+	return folder;
+}
+
+/* calls @func for the persons in @scope, whose books have to be read */
+static void sync_scope_foreach_person(GPtrArray *scope, PersonFunc func)
+{
+	guint i;
+
+	for (i = 0; i < scope->len; i++) {
+		SyncScopeEntry *entry = g_ptr_array_index(scope, i);
+
+		if (entry->folder_ids) {
+			ItemFolder *folder;
+			folder = sync_scope_find_folder(entry);
+			if (folder)
+				folder_foreach_person(folder, entry->ds, func);
+		}
+		else {
+			GList *persons, *walk;
+			persons = addrindex_ds_get_all_persons(entry->ds);
+			for (walk = persons; walk; walk = walk->next)
+				func(walk->data, entry->ds);
+			g_list_free(persons);
+		}
+	}
+}
+
+static void folder_foreach_person(ItemFolder *folder, AddressDataSource *ds,
+																	PersonFunc func)
+{
+	GList *walk;
+
+	for (walk = folder->listPerson; walk; walk = walk->next)
+		func(walk->data, ds);
+	for (walk = folder->listFolder; walk; walk = walk->next)
+		folder_foreach_person(walk->data, ds, func);
+}
+
+/* indexes the contacts of the sync scope, if that is not done yet in
+   this session.  The book new contacts go to may be outside of the
+   scope, duplicates of them are looked for there, too. */
+static void contact_index_build(void)
+{
+	GPtrArray *scope;
+	AddressDataSource *book = NULL;
+	ItemFolder *folder = NULL;
+	guint i;
+
+	if (opensync_index_exists())
+		return;
+
+	opensync_index_create();
+	scope = sync_scope_get();
+	if (scope) {
+		load_address_books(scope);
+		sync_scope_foreach_person(scope, contact_index_add);
+		for (i = 0; i < scope->len; i++) {
+			SyncScopeEntry *entry = g_ptr_array_index(scope, i);
+			if (!entry->folder_ids)
+				contact_index_books = g_slist_prepend(contact_index_books, entry->ds);
+		}
+		sync_scope_free(scope);
+	}
+
+	if (new_contacts_book && opensync_address_book_is_known(new_contacts_book))
+		contact_index_add_book(new_contacts_book);
+	else if (opensync_config.addrbook_folderpath &&
+					 addressbook_peek_folder_exists(opensync_config.addrbook_folderpath,
+																					&book, &folder) && book)
+		contact_index_add_book(book);
+}
+
+/* indexes all contacts of @ds, unless they are already */
+static void contact_index_add_book(AddressDataSource *ds)
+{
+	GList *persons, *walk;
+
+	if (!opensync_index_exists() || g_slist_find(contact_index_books, ds))
+		return;
+
+	if (!addrindex_ds_get_read_flag(ds))
+		addrindex_ds_read_data(ds);
+	persons = addrindex_ds_get_all_persons(ds);
+	for (walk = persons; walk; walk = walk->next)
+		opensync_index_add_person(walk->data, ds);
+	g_list_free(persons);
+
+	contact_index_books = g_slist_prepend(contact_index_books, ds);
+}
+
+static gint contact_index_add(ItemPerson *person, AddressDataSource *ds)
+{
+	opensync_index_add_person(person, ds);
+	return 0;
+}
+
+/* a contact that has the name and one of the addresses a new contact
+   from @vformat would get, see opensync_index_find_duplicate() */
+static ItemPerson* find_duplicate_contact(VFormat *vformat,
+																					AddressDataSource **ds)
+{
+	PersonUpdate update;
+	GPtrArray *emails;
+	ItemPerson *person;
+	guint num_attr, i;
+
+	contact_index_build();
+
+	memset(&update, 0, sizeof(update));
+	emails = g_ptr_array_new();
+	num_attr = vformat_get_n_attributes(vformat);
+	for (i = 0; i < num_attr; i++) {
+		VFormatAttribute *attr;
+
+		attr = vformat_get_nth_attribute(vformat, i);
+		switch (vformat_attribute_get_atom(attr)) {
+		case VF_ATOM_N:
+			name_import(&update, attr);
+			break;
+		case VF_ATOM_FN:
+			display_name_import(&update, attr);
+			break;
+		case VF_ATOM_EMAIL:
+			if (vformat_attribute_is_single_valued(attr) &&
+					email_attribute_is_internet(attr) &&
+					vformat_attribute_get_nth_value(attr, 0))
+				g_ptr_array_add(emails,
+												(gpointer)vformat_attribute_get_nth_value(attr, 0));
+			break;
+		default:
+			break;
+		}
+	}
+
+	person = opensync_index_find_duplicate(update.common_name, emails, ds);
+	g_free(update.common_name);
+	g_ptr_array_free(emails, TRUE);
+
+	return person;
+}
+
+/* FALSE if the socket failed */
+static gboolean send_contact(gint fd, ItemPerson *person, AddressDataSource *ds)
+{
+	gchar *return_vcard;
+	gchar *msg;
+	gboolean sent;
+
+	return_vcard = vcard_get_from_ItemPerson(person, ds);
+	msg = g_strdup_printf("%s\n", return_vcard);
+	g_free(return_vcard);
+	sent = sock_send(fd, ":start_contact:\n") &&
+		sock_send(fd, msg) &&
+		sock_send(fd, ":end_contact:\n");
+	g_free(msg);
+
+	return sent;
+}
+
+/* Reads the address books of @scope that are not loaded yet.  The
+   address book code is not re-entrant, so this is done one book after
+   another on the main thread. */
+static void load_address_books(GPtrArray *scope)
+{
+	GPtrArray *books;
+	guint i, j;
+
+	books = g_ptr_array_new();
+	for (i = 0; i < scope->len; i++) {
+		AddressDataSource *ds = ((SyncScopeEntry*)g_ptr_array_index(scope, i))->ds;
+
+		if (!ds->rawDataSource || addrindex_ds_get_read_flag(ds))
+			continue;
+		for (j = 0; j < books->len; j++) {
+			if (g_ptr_array_index(books, j) == ds)
+				break;
+		}
+		if (j == books->len) {
+			addrindex_ds_read_data(ds);
+			g_ptr_array_add(books, ds);
+		}
+	}
+
+	g_print("Loaded %d address books\n", books->len);
+	g_ptr_array_free(books, TRUE);
 }
 
 static void received_contact_modify_request(gint fd)
 {
 	gchar buf[BUFFSIZE];
 	gchar *return_vcard = NULL;
+	gboolean unchanged = FALSE;
 
 	if (fd_gets(fd, buf, sizeof(buf)) != -1) {
 		gchar *id;
-		ContactHashVal *hash_val;
+		AddressDataSource *ds;
+		ItemPerson *person;
+		VFormatParser *parser;
+		VFormat *vformat;
+		gboolean done = FALSE;
+
 		id = g_strchomp(buf);
 		g_print("id to change: '%s'\n",id);
-		hash_val = g_hash_table_lookup(contact_hash, id);
-		if(hash_val) {
+		person = contact_hash_lookup(id, &ds);
+
+		/* the vCard is read in any case, to keep the protocol in step */
+		parser = vformat_parser_new();
+		while(!done) {
+			if(fd_gets(answer_sock, buf, sizeof(buf)) == -1) {
+				g_print("error receiving contact to modify\n");
+				break;
+			}
+			g_print("buf: %s\n",buf);
+			if(g_str_has_prefix(buf,":done:"))
+				done = TRUE;
+			else
+				vformat_parser_feed(parser, buf, strlen(buf));
+		}
+		vformat = vformat_parser_finish(parser);
+
+		if(!person)
+			g_printf("warning: tried to modify non-existent contact\n");
+		else if(!update_ItemPerson_from_vcard(ds, person, vformat, FALSE)) {
+			/* nothing to ask for and nothing to write */
+			g_print("contact '%s' is unchanged\n", ADDRITEM_NAME(person));
+			unchanged = TRUE;
+		}
+		else {
 			AlertValue val;
 			val = G_ALERTALTERNATE;
 			if(opensync_config.contact_ask_modify) {
 				gchar *msg;
 				msg = g_strdup_printf(_("Really modify contact for '%s'?"),
-															ADDRITEM_NAME(hash_val->person));
+															ADDRITEM_NAME(person));
 				val = alertpanel(_("OpenSync plugin"),msg,
 												 GTK_STOCK_CANCEL,GTK_STOCK_EDIT,NULL);
 				g_free(msg);
 			}
 			if((!opensync_config.contact_ask_modify) || (val != G_ALERTDEFAULT)) {
-				gchar *vcard = g_strdup("");
-				gchar *tmp;
-				gboolean done = FALSE;
-				AddressBookFile *abf;
-				
-				while(!done) {
-					if(fd_gets(answer_sock, buf, sizeof(buf)) == -1) {
-						g_print("error receiving contact to modify\n");
-						break;
-					}
-					g_print("buf: %s\n",buf);
-					if(g_str_has_prefix(buf,":done:"))
-						done = TRUE;
-					else {
-						tmp = vcard;
-						vcard = g_strconcat(tmp,buf,NULL);
-						g_free(tmp);
-					}
-				}
-				abf = hash_val->ds->rawDataSource;
-				g_print("Modification to: '%s'\n",vcard);
-				update_ItemPerson_from_vcard(abf, hash_val->person, vcard);
-				g_free(vcard);
-				return_vcard = vcard_get_from_ItemPerson(hash_val->person);
+				update_ItemPerson_from_vcard(ds, person, vformat, TRUE);
+				opensync_index_add_person(person, ds);
+				return_vcard = vcard_get_from_ItemPerson(person, ds);
 			}
 			else {
 				g_print("Error: User refused to modify contact '%s'\n",
-								ADDRITEM_NAME(hash_val->person));
+								ADDRITEM_NAME(person));
 			}
 		}
-		else
-			g_printf("warning: tried to modify non-existent contact\n");
+		vformat_free(vformat);
 
 		if(return_vcard) {
-			send_
 			gchar *msg;
 			sock_send(fd, ":start_contact:\n");
 			msg = g_strdup_printf("%s\n", return_vcard);
@@ -219,6 +832,8 @@ static void received_contact_modify_request(gint fd)
 			g_free(msg);
 			sock_send(fd, ":end_contact:\n");	  
 		}
+		else if(unchanged)
+			sock_send(fd, ":unchanged:\n");
 		else
 			sock_send(fd, ":failure:\n");
 	}
@@ -231,24 +846,26 @@ static void received_contact_delete_request(gint fd)
 
 	if (fd_gets(fd, buf, sizeof(buf)) != -1) {
 		gchar *id;
-		ContactHashVal *hash_val;
+		AddressDataSource *ds;
+		ItemPerson *person;
 		id = g_strchomp(buf);
-		hash_val = g_hash_table_lookup(contact_hash, id);
+		person = contact_hash_lookup(id, &ds);
 
-		if (hash_val) {
+		if (person) {
 			AlertValue val;
 			val = G_ALERTALTERNATE;
 			if(opensync_config.contact_ask_delete) {
 				gchar *msg;
 				msg = g_strdup_printf(_("Really delete contact for '%s'?"),
-															ADDRITEM_NAME(hash_val->person));
+															ADDRITEM_NAME(person));
 				val = alertpanel(_("OpenSync plugin"),msg,
 												 GTK_STOCK_CANCEL,GTK_STOCK_DELETE,NULL);
 				g_free(msg);
 			}
 			if(((!opensync_config.contact_ask_delete) || (val != G_ALERTDEFAULT)) &&
-				 (addrduplicates_delete_item_person(hash_val->person,hash_val->ds))) {
+				 (addrduplicates_delete_item_person(person, ds))) {
 				g_print("Deleted id: '%s'\n", id);
+				opensync_index_remove_person(person);
 				delete_successful = TRUE;
 			}
 		}
@@ -263,110 +880,402 @@ static void received_contact_delete_request(gint fd)
 
 static void received_contact_add_request(gint fd)
 {
-	gchar *vcard;
+	VFormat *vformat;
 	gchar *msg;
 	gboolean add_successful;
 	ItemPerson *person;
+	AddressDataSource *book = NULL;
 
 	add_successful = FALSE;
-	vcard = get_next_contact();
+	vformat = get_next_contact();
 
-	if (vcard) {
+	if (vformat) {
+		AlertValue val;
+
+		/* a contact that is there already is handed back instead */
+		person = find_duplicate_contact(vformat, &book);
+		if (person) {
+			g_print("Contact '%s' exists already\n", ADDRITEM_NAME(person));
+			add_successful = TRUE;
+		}
+		else {
+			val = G_ALERTALTERNATE;
+			if (opensync_config.contact_ask_add) {
+				gchar *vcard;
+				vcard = vformat_to_string(vformat, VFORMAT_CARD_21);
+				msg = g_strdup_printf(_("Really add contact:\n%s?"),vcard);
+				g_free(vcard);
+				val = alertpanel(_("OpenSync plugin"),msg,
+												 GTK_STOCK_CANCEL,GTK_STOCK_ADD,NULL);
+				g_free(msg);
+			}
+			if (!opensync_config.contact_ask_add || (val != G_ALERTDEFAULT)) {
+				ItemFolder *folder = NULL;
+
+				if (get_folder_for_new_contacts(&book, &folder)) {
+					person = add_contact_from_vformat(book, folder, vformat);
+					add_successful = TRUE;
+				}
+			}
+			else {
+				g_print("Error: User refused to add contact\n");
+			}
+		}
+	}
+	else {
+		g_print("Error: Not able to get the contact to add\n");
+	}
+	if(add_successful)
+		send_contact(fd, person, book);
+	else {
+	  sock_send(fd, ":failure:\n");
+	}
+	if (vformat)
+		vformat_free(vformat);
+}
+
+/* the address book folder new contacts go to, asking the user if
+   configured that way.  Unless the user is asked for each contact, the
+   folder is looked up once per sync session.  FALSE if there is none. */
+static gboolean get_folder_for_new_contacts(AddressDataSource **book,
+																						ItemFolder **folder)
+{
+	gchar *path = NULL;
+	gboolean found;
+
+	if(new_contacts_path &&
+		 (new_contacts_choice == opensync_config.addrbook_choice) &&
+		 ((new_contacts_choice == OPENSYNC_ADDRESS_BOOK_ASK_ONCE) ||
+			str_equal_null(new_contacts_path, opensync_config.addrbook_folderpath)) &&
+		 address_book_has_folder(new_contacts_book, new_contacts_folder)) {
+		*book = new_contacts_book;
+		*folder = new_contacts_folder;
+		return TRUE;
+	}
+	forget_folder_for_new_contacts();
+
+	if(opensync_config.addrbook_choice != OPENSYNC_ADDRESS_BOOK_DEFAULT)
+		path = addressbook_folder_selection(NULL);
+	if(!path)
+		path = g_strdup(opensync_config.addrbook_folderpath);
+
+	found = addressbook_peek_folder_exists(path, book, folder) && *book;
+	if (!found)
+		g_warning("addressbook folder not found '%s'\n", path);
+	else {
+		/* so that contacts added there are found as duplicates */
+		contact_index_build();
+		contact_index_add_book(*book);
+
+		if (opensync_config.addrbook_choice != OPENSYNC_ADDRESS_BOOK_INDIVIDUAL) {
+			new_contacts_book = *book;
+			new_contacts_folder = *folder;
+			new_contacts_choice = opensync_config.addrbook_choice;
+			new_contacts_path = path;
+			path = NULL;
+		}
+	}
+	g_free(path);
+
+	return found;
+}
+
+static void forget_folder_for_new_contacts(void)
+{
+	g_free(new_contacts_path);
+	new_contacts_path = NULL;
+	new_contacts_book = NULL;
+	new_contacts_folder = NULL;
+}
+
+/* whether @ds is still one of the address books and has @folder, they
+   may have been removed since the folder was looked up.  @folder may be
+   NULL for the top level of the book. */
+static gboolean address_book_has_folder(AddressDataSource *ds,
+																				ItemFolder *folder)
+{
+	if (!opensync_address_book_is_known(ds))
+		return FALSE;
+	return !folder || folder_contains(addrindex_ds_get_root_folder(ds), folder);
+}
+
+/* whether @folder is @parent or below it, only comparing pointers */
+static gboolean folder_contains(ItemFolder *parent, ItemFolder *folder)
+{
+	GList *walk;
+
+	if (!parent)
+		return FALSE;
+	if (parent == folder)
+		return TRUE;
+	for (walk = parent->listFolder; walk; walk = walk->next) {
+		if (folder_contains(walk->data, folder))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static ItemPerson* add_contact_from_vformat(AddressDataSource *book,
+																						ItemFolder *folder, VFormat *vformat)
+{
+	AddressBookFile *abf;
+	ItemPerson *person;
+
+	abf = book->rawDataSource;
+	person = addrbook_add_contact(abf, folder, "", "", "");
+	person->status = ADD_ENTRY;
+	update_ItemPerson_from_vcard(book, person, vformat, TRUE);
+	opensync_index_add_person(person, book);
+
+	return person;
+}
+
+static void received_contacts_add_request(gint fd)
+{
+	GString *vcards;
+	GPtrArray *formats;
+	char *line;
+	gboolean add_successful;
+	guint i;
+
+	/* collect the whole batch, then parse it off the main thread */
+	vcards = g_string_new("");
+	while ((line = sock_get_next_line(answer_sock)) != NULL) {
+		if (g_str_has_prefix(line, ":done:"))
+			break;
+		else if (g_str_has_prefix(line, ":start_contact:") ||
+						 g_str_has_prefix(line, ":end_contact:"))
+			continue;
+		g_string_append(vcards, line);
+	}
+	formats = vformat_parse_bulk(vcards->str, vcards->len, 0);
+	g_string_free(vcards, TRUE);
+	g_print("Received %d contacts to add\n", formats->len);
+
+	add_successful = FALSE;
+	if (formats->len) {
 		AlertValue val;
 		val = G_ALERTALTERNATE;
 		if (opensync_config.contact_ask_add) {
-			msg = g_strdup_printf(_("Really add contact:\n%s?"),vcard);
+			gchar *msg;
+			msg = g_strdup_printf(_("Really add %d contacts?"), formats->len);
 			val = alertpanel(_("OpenSync plugin"),msg,
 											 GTK_STOCK_CANCEL,GTK_STOCK_ADD,NULL);
 			g_free(msg);
 		}
 		if (!opensync_config.contact_ask_add || (val != G_ALERTDEFAULT)) {
-			gchar *path = NULL;
 			AddressDataSource *book = NULL;
 			ItemFolder *folder = NULL;
-			AddressBookFile *abf = NULL;
-
-			if(opensync_config.addrbook_choice == OPENSYNC_ADDRESS_BOOK_INDIVIDUAL)
-				path = addressbook_folder_selection(NULL);
-			if(!path)
-				path = g_strdup(opensync_config.addrbook_folderpath);
-
-			if (addressbook_peek_folder_exists(path, &book, &folder) && book) {
-				abf = book->rawDataSource;
-				person = addrbook_add_contact(abf, folder, "", "", "");
-				person->status = ADD_ENTRY;
-				update_ItemPerson_from_vcard(abf, person, vcard);
+
+			if (get_folder_for_new_contacts(&book, &folder))
 				add_successful = TRUE;
+
+			/* the address book itself is only touched from here */
+			for (i = 0; add_successful && (i < formats->len); i++) {
+				VFormat *vformat = g_ptr_array_index(formats, i);
+				AddressDataSource *dup_book;
+				ItemPerson *person;
+
+				/* contacts that are there already are handed back instead,
+				 * this includes the ones added earlier in the batch */
+				person = find_duplicate_contact(vformat, &dup_book);
+				if (person)
+					g_print("Contact '%s' exists already\n", ADDRITEM_NAME(person));
+				else {
+					person = add_contact_from_vformat(book, folder, vformat);
+					dup_book = book;
+				}
+				send_contact(fd, person, dup_book);
 			}
-			else
-				g_warning("addressbook folder not found '%s'\n", path);
-			g_free(path);
 		}
 		else {
-			g_print("Error: User refused to add contact '%s'\n", vcard);
+			g_print("Error: User refused to add contacts\n");
 		}
 	}
-	else {
-		g_print("Error: Not able to get the contact to add\n");
+
+	if(add_successful)
+		sock_send(fd, ":done:\n");
+	else
+		sock_send(fd, ":failure:\n");
+
+	for (i = 0; i < formats->len; i++)
+		vformat_free(g_ptr_array_index(formats, i));
+	g_ptr_array_free(formats, TRUE);
+}
+
+/* answers from the contact index, without exporting anything.  The
+   contact can be modified and deleted afterwards like an exported one. */
+static void received_find_contact_by_email_request(gint fd, const gchar *line)
+{
+	gchar *email;
+	ItemPerson *person;
+	AddressDataSource *ds;
+
+	email = g_strstrip(g_strdup(line + strlen(":find_contact_by_email:")));
+	contact_index_build();
+	person = opensync_index_find_email(email, &ds);
+	g_print("Contact for '%s': %s\n", email, person ? ADDRITEM_ID(person) : "none");
+	g_free(email);
+
+	if (person) {
+		if (send_contact(fd, person, ds))
+			contact_hash_add(person, ds);
 	}
-	if(add_successful) {
-		gchar *return_vcard;
-		return_vcard = vcard_get_from_ItemPerson(person);
-		
-	  sock_send(fd, ":start_contact:\n");
-	  msg = g_strdup_printf("%s\n", return_vcard);
-		g_free(return_vcard);
-	  sock_send(fd, msg);
-	  g_free(msg);
-	  sock_send(fd, ":end_contact:\n");	  
+	else
+		sock_send(fd, ":failure:\n");
+}
+
+#define SEARCH_CONTACTS_DEFAULT_LIMIT 20
+
+/* the request line is ":search_contacts: <limit> <text>", a limit of 0
+   takes the default.  The text is the rest of the line and may contain
+   blanks.  Answered from the contact index. */
+static void received_search_contacts_request(gint fd, const gchar *line)
+{
+	const gchar *args;
+	gchar *end, *text;
+	guint limit;
+	GArray *hits;
+	guint i;
+
+	args = line + strlen(":search_contacts:");
+	while (*args == ' ')
+		args++;
+	if (*args < '0' || *args > '9') {
+		g_print("Error: search request without a limit\n");
+		sock_send(fd, ":failure:\n");
+		return;
 	}
-	else {
-	  sock_send(fd, ":failure:\n");
+	limit = (guint) g_ascii_strtoull(args, &end, 10);
+	if (!limit)
+		limit = SEARCH_CONTACTS_DEFAULT_LIMIT;
+	text = g_strstrip(g_strdup(end));
+
+	contact_index_build();
+	hits = opensync_index_search(text, limit);
+	g_print("Found %d contacts for '%s'\n", hits->len, text);
+	g_free(text);
+
+	for (i = 0; i < hits->len; i++) {
+		OpenSyncIndexHit *hit = &g_array_index(hits, OpenSyncIndexHit, i);
+		if (!send_contact(fd, hit->person, hit->ds)) {
+			g_array_free(hits, TRUE);
+			return;
+		}
+		contact_hash_add(hit->person, hit->ds);
+	}
+	g_array_free(hits, TRUE);
+
+	sock_send(fd, ":done:\n");
+}
+
+/* a sync session starts.  New connections wait until it is over. */
+static gboolean listen_channel_input_cb(GIOChannel *chan, GIOCondition cond,
+																				gpointer data)
+{
+	gint sock;
+
+	sock = g_io_channel_unix_get_fd(chan);
+	answer_sock = fd_accept(sock);
+	if (answer_sock < 0) {
+		answer_sock = -1;
+		return TRUE;
 	}
-	g_free(vcard);
+
+	session_watch_requests();
+	listen_source_id = 0;
+	return FALSE;
 }
 
-static gboolean listen_channel_input_cb(GIOChannel *chan, GIOCondition cond,
+/* one request of the session */
+static gboolean answer_channel_input_cb(GIOChannel *chan, GIOCondition cond,
 																				gpointer data)
 {
-	gint sock;
 	gchar buf[BUFFSIZE];
 
-	if (answer_sock != -1)
-		return TRUE;
+	if (fd_gets(answer_sock, buf, sizeof(buf)) == -1) {
+		answer_source_id = 0;
+		session_close();
+		return FALSE;
+	}
 
-	sock = g_io_channel_unix_get_fd(chan);
-	answer_sock = fd_accept(sock);
+	g_print("Received request: %s", buf);
+	if(g_str_has_prefix(buf,":request_contacts:"))
+		received_contacts_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":modify_contact:"))
+		received_contact_modify_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":delete_contact:"))
+		received_contact_delete_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":add_contact:"))
+		received_contact_add_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":add_contacts:"))
+		received_contacts_add_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":find_contact_by_email:"))
+		received_find_contact_by_email_request(answer_sock, buf);
+	else if(g_str_has_prefix(buf, ":search_contacts:"))
+		received_search_contacts_request(answer_sock, buf);
+	else if(g_str_has_prefix(buf, ":request_events:"))
+		received_events_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":modify_event:"))
+		received_event_modify_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":delete_event:"))
+		received_event_delete_request(answer_sock);
+	else if(g_str_has_prefix(buf, ":add_event:"))
+		received_event_add_request(answer_sock);
+	else if(g_str_has_prefix(buf,":finished:")) {
+		received_finished_notification(answer_sock);
+		answer_source_id = 0;
+		session_close();
+		return FALSE;
+	}
 
-	while (fd_gets(answer_sock, buf, sizeof(buf)) != -1) {
-		g_print("Received request: %s", buf);
-		if(g_str_has_prefix(buf,":request_contacts:"))
-			received_contacts_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":modify_contact:"))
-			received_contact_modify_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":delete_contact:"))
-			received_contact_delete_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":add_contact:"))
-			received_contact_add_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":request_events:"))
-			received_events_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":modify_event:"))
-			received_event_modify_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":delete_event:"))
-			received_event_delete_request(answer_sock);
-		else if(g_str_has_prefix(buf, ":add_event:"))
-			received_event_add_request(answer_sock);
-		else if(g_str_has_prefix(buf,":finished:")) {
-			received_finished_notification(answer_sock);
-			break;
-		}
+	/* the next request is read when the export is done */
+	if (export_source_id) {
+		answer_source_id = 0;
+		return FALSE;
 	}
+	return TRUE;
+}
+
+static void session_watch_requests(void)
+{
+	GIOChannel *chan;
+
+	chan = g_io_channel_unix_new(answer_sock);
+	answer_source_id = g_io_add_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR,
+																		answer_channel_input_cb, NULL);
+	g_io_channel_unref(chan);
+}
 
+/* ends the session, whether or not the client said it is finished, and
+   waits for the next one */
+static void session_close(void)
+{
+	if (export_source_id) {
+		g_source_remove(export_source_id);
+		export_source_id = 0;
+	}
+	if (answer_source_id) {
+		g_source_remove(answer_source_id);
+		answer_source_id = 0;
+	}
 	fd_close(answer_sock);
 	answer_sock = -1;
 	g_print("closed answer sock\n");
 
-	return TRUE;
+	/* also when the client went away without :finished: */
+	if (contact_hash) {
+		g_hash_table_destroy(contact_hash);
+		contact_hash = NULL;
+	}
+	forget_folder_for_new_contacts();
+	opensync_index_clear();
+	g_slist_free(contact_index_books);
+	contact_index_books = NULL;
+
+	if (listen_channel && !listen_source_id)
+		listen_source_id = g_io_add_watch(listen_channel, G_IO_IN,
+																			listen_channel_input_cb, NULL);
 }
 
 static gint uxsock_remove(void)
@@ -428,45 +1337,110 @@ static gchar* opensync_get_socket_name(void)
 	return filename;
 }
 
+/* -1 if the socket failed */
 static gint addrbook_entry_send(ItemPerson *itemperson, AddressDataSource *ds)
 {
 	gchar *vcard;
-	ContactHashVal *val;
+	gboolean sent;
 
-	vcard = vcard_get_from_ItemPerson(itemperson);
-	sock_send(answer_sock, ":start_contact:\n");
-	sock_send(answer_sock, vcard);
-	sock_send(answer_sock, ":end_contact:\n");
+	vcard = vcard_get_from_ItemPerson(itemperson, ds);
+	sent = sock_send(answer_sock, ":start_contact:\n") &&
+		sock_send(answer_sock, vcard) &&
+		sock_send(answer_sock, ":end_contact:\n");
 	g_free(vcard);
+	if (!sent)
+		return -1;
+
+	contact_hash_add(itemperson, ds);
+
+	return 0;
+}
 
-	/* Remember contacts for easier changing */
+/* Remember contacts for easier changing.  Only the data source is kept
+   with the UID, the person may be freed in the GUI during the session. */
+static void contact_hash_add(ItemPerson *itemperson, AddressDataSource *ds)
+{
 	if (!contact_hash)
 		contact_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-																				 g_free);
+																				 NULL);
 
-	val = g_new0(ContactHashVal,1);
-	val->person = itemperson;
-	val->ds = ds;
-	g_hash_table_insert(contact_hash, g_strdup(ADDRITEM_ID(itemperson)), val);
+	g_hash_table_insert(contact_hash, g_strdup(ADDRITEM_ID(itemperson)), ds);
+}
 
-	return 0;
+/* the remembered contact with the UID @id, looked up again.  NULL if it
+   was not sent in this session or is gone since. */
+static ItemPerson* contact_hash_lookup(const gchar *id,
+																			 AddressDataSource **ds)
+{
+	if (!contact_hash)
+		return NULL;
+
+	*ds = g_hash_table_lookup(contact_hash, id);
+	if (!*ds)
+		return NULL;
+
+	return opensync_data_source_get_person(*ds, id);
 }
 
-static gchar* vcard_get_from_ItemPerson(ItemPerson *item)
+/* like strcmp() == 0, but either may be NULL */
+static gboolean str_equal_null(const gchar *a, const gchar *b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static gchar* vcard_get_from_ItemPerson(ItemPerson *item,
+																				AddressDataSource *ds)
 {
 	VFormat *vformat;
 	gchar *vcard;
-	VFormatParam *param;
-	VFormatAttribute *attr;
-	GList *walk;
+	guint i;
 
 	vformat = vformat_new();
 
-	/* UID */
+	for (i = 0; i < G_N_ELEMENTS(person_fields); i++) {
+		if (person_fields[i].export_field)
+			person_fields[i].export_field(vformat, item);
+	}
+	categories_export(vformat, item, ds);
+
+	vcard = vformat_to_string(vformat, VFORMAT_CARD_21);
+	vformat_free(vformat);
+
+	return vcard;
+}
+
+/* the person_fields entry for @atom, or NULL if it is not synced */
+static const PersonFieldMap* person_field_lookup(VFormatAtom atom)
+{
+	static const PersonFieldMap *by_atom[VF_ATOM_N_KNOWN];
+	static gboolean initialized = FALSE;
+
+	if (!initialized) {
+		guint i;
+		for (i = 0; i < G_N_ELEMENTS(person_fields); i++)
+			by_atom[person_fields[i].atom] = &person_fields[i];
+		initialized = TRUE;
+	}
+
+	if ((guint)atom >= VF_ATOM_N_KNOWN)
+		return NULL;
+	return by_atom[atom];
+}
+
+static void uid_export(VFormat *vformat, ItemPerson *item)
+{
+	VFormatAttribute *attr;
+
 	attr = vformat_attribute_new(NULL,"UID");
 	vformat_add_attribute_with_value(vformat, attr, ADDRITEM_ID(item));
+}
+
+static void name_export(VFormat *vformat, ItemPerson *item)
+{
+	VFormatAttribute *attr;
 
-	/* Name */
 	if(item->lastName || item->firstName) {
 		attr = vformat_attribute_new(NULL,"N");
 		vformat_add_attribute_with_values(vformat, attr,
@@ -475,14 +1449,72 @@ static gchar* vcard_get_from_ItemPerson(ItemPerson *item)
 																			: "",
 																			NULL);
 	}
+}
+
+static void name_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	const gchar *first_name;
+	const gchar *last_name;
+
+	last_name = vformat_attribute_get_nth_value(attr,0);
+	first_name = vformat_attribute_get_nth_value(attr, 1);
+
+	if(last_name)
+		update->last_name = last_name;
+	if(first_name)
+		update->first_name = first_name;
+
+	if(last_name || first_name) {
+		g_free(update->common_name);
+		update->common_name = g_strdup_printf("%s %s",
+																					first_name?first_name:"",
+																					last_name?last_name:"");
+	}
+}
+
+static void display_name_export(VFormat *vformat, ItemPerson *item)
+{
+	VFormatAttribute *attr;
 
-	/* Formatted name */
 	if(ADDRITEM_NAME(item)) {
 		attr = vformat_attribute_new(NULL,"FN");
 		vformat_add_attribute_with_value(vformat, attr, ADDRITEM_NAME(item));
 	}
+}
+
+static void display_name_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	const gchar *display_name;
+
+	display_name = vformat_attribute_get_nth_value(attr,0);
+	g_free(update->common_name);
+	update->common_name = g_strdup(display_name?display_name:"");
+}
+
+static void nick_name_export(VFormat *vformat, ItemPerson *item)
+{
+	VFormatAttribute *attr;
+
+	if(item->nickName && *item->nickName) {
+		attr = vformat_attribute_new(NULL,"NICKNAME");
+		vformat_add_attribute_with_value(vformat, attr, item->nickName);
+	}
+}
+
+static void nick_name_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	const gchar *nick_name;
+
+	nick_name = vformat_attribute_get_nth_value(attr,0);
+	update->nick_name = nick_name ? nick_name : "";
+}
+
+static void email_export(VFormat *vformat, ItemPerson *item)
+{
+	VFormatParam *param;
+	VFormatAttribute *attr;
+	GList *walk;
 
-	/* EMail addresses */
 	for (walk = item->listEMail; walk; walk = walk->next) {
 		gchar *email;
 		email = ((ItemEMail*)walk->data)->address;
@@ -491,152 +1523,449 @@ static gchar* vcard_get_from_ItemPerson(ItemPerson *item)
 		vformat_attribute_add_param(attr, param);
 		vformat_add_attribute_with_value(vformat, attr, email);
 	}
+}
 
-	vcard = vformat_to_string(vformat, VFORMAT_CARD_21);
-	vformat_free(vformat);
+/* Internet EMail addresses */
+static void email_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	if (!vformat_attribute_is_single_valued(attr)) {
+		g_print("Error: EMAIL is supposed to be single valued\n");
+		return;
+	}
 
-	return vcard;
+	if (email_attribute_is_internet(attr)) {
+		const gchar *email;
+		email = vformat_attribute_get_nth_value(attr, 0);
+		if (email) {
+			update->numEmail++;
+			email_merge_add(&update->emails, email);
+		}
+	}
 }
 
-static void update_ItemPerson_from_vcard(AddressBookFile *abf,
-																				 ItemPerson *item, gchar *vcard)
+static gboolean email_attribute_is_internet(VFormatAttribute *attr)
 {
-	VFormat *vformat;
-	GList *attr_list, *walk;
-	gint numEmail;
-	GList *emailWalk;
-	GList *savedMailList;
+	/* INTERNET is default. Evolution may also put HOME or WORK,
+	 * though I don't think this is legal. */
+	return (!vformat_attribute_get_n_params(attr) ||
+					(vformat_attribute_type_mask(attr) &
+					 (VF_TYPE_INTERNET | VF_TYPE_HOME | VF_TYPE_WORK)));
+}
+
+static void birthday_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	update->birthday = vformat_attribute_get_nth_value(attr, 0);
+}
+
+static void notes_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	update->notes = vformat_attribute_get_nth_value(attr, 0);
+}
+
+/* Birthday and Notes go to BDAY and NOTE, the other user attributes to
+   X-CLAWS-ATTRIBUTE:name;value */
+static void attribs_export(VFormat *vformat, ItemPerson *item)
+{
+	VFormatAttribute *attr;
+	GList *walk;
+
+	for (walk = item->listAttrib; walk; walk = walk->next) {
+		UserAttribute *attrib = walk->data;
+		const gchar *value;
+
+		if (!attrib->name || !*attrib->name)
+			continue;
+		value = attrib->value ? attrib->value : "";
+
+		if (!strcmp(attrib->name, ATTRIB_BIRTHDAY)) {
+			attr = vformat_attribute_new(NULL,"BDAY");
+			vformat_add_attribute_with_value(vformat, attr, value);
+		}
+		else if (!strcmp(attrib->name, ATTRIB_NOTES)) {
+			attr = vformat_attribute_new(NULL,"NOTE");
+			vformat_add_attribute_with_value(vformat, attr, value);
+		}
+		else {
+			attr = vformat_attribute_new(NULL,"X-CLAWS-ATTRIBUTE");
+			vformat_add_attribute_with_values(vformat, attr, attrib->name, value,
+																				NULL);
+		}
+	}
+}
+
+static void attribs_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	const gchar *name;
+	const gchar *value;
+
+	name = vformat_attribute_get_nth_value(attr, 0);
+	value = vformat_attribute_get_nth_value(attr, 1);
+	if (!update->attribs)
+		update->attribs = g_ptr_array_new();
+	if (!name || !*name)
+		return;
+
+	g_ptr_array_add(update->attribs, (gpointer)name);
+	g_ptr_array_add(update->attribs, (gpointer)(value ? value : ""));
+}
+
+/* the groups of the address book that the person is in, sorted by name
+   to keep the vCard stable */
+static void categories_export(VFormat *vformat, ItemPerson *item,
+															AddressDataSource *ds)
+{
+	VFormatAttribute *attr = NULL;
+	GSList *groups, *walk;
 
-	numEmail = 0;
+	groups = g_slist_sort(opensync_index_get_groups(item, ds),
+												group_name_compare);
+	for (walk = groups; walk; walk = walk->next) {
+		const gchar *name = ADDRITEM_NAME(walk->data);
 
-	vformat = vformat_new_from_string(vcard);
+		if (!name || !*name)
+			continue;
+		if (!attr)
+			attr = vformat_attribute_new(NULL,"CATEGORIES");
+		vformat_attribute_add_value(attr, name);
+	}
+	if (attr)
+		vformat_add_attribute(vformat, attr);
+	g_slist_free(groups);
+}
+
+static void categories_import(PersonUpdate *update, VFormatAttribute *attr)
+{
+	GList *walk;
 
-	/* steal email list */
-	savedMailList = NULL;
-	for (emailWalk = item->listEMail; emailWalk; emailWalk = emailWalk->next) {
-		ItemEMail *itemEMail;
-		itemEMail = emailWalk->data;
-		itemEMail = addritem_person_remove_email(item, itemEMail);
-		if (itemEMail)
-			savedMailList = g_list_append(savedMailList, itemEMail);
+	if (!update->categories)
+		update->categories = g_ptr_array_new();
+	for (walk = vformat_attribute_get_values(attr); walk; walk = walk->next) {
+		gchar *name;
+
+		name = g_strstrip(g_strdup(walk->data));
+		if (*name)
+			g_ptr_array_add(update->categories, name);
+		else
+			g_free(name);
 	}
+}
+
+static gint group_name_compare(gconstpointer a, gconstpointer b)
+{
+	const gchar *name_a = ADDRITEM_NAME(a);
+	const gchar *name_b = ADDRITEM_NAME(b);
+
+	return strcmp(name_a ? name_a : "", name_b ? name_b : "");
+}
 
-	attr_list = vformat_get_attributes(vformat);
-	for (walk = attr_list; walk; walk = walk->next) {
+/* compares @item of the address book @ds with the synced fields of
+   @vformat and, if @apply is set, updates it where they differ.  Neither
+   @item nor the book are touched if nothing differs.  Returns whether
+   anything differed. */
+static gboolean update_ItemPerson_from_vcard(AddressDataSource *ds,
+																						 ItemPerson *item, VFormat *vformat,
+																						 gboolean apply)
+{
+	AddressBookFile *abf = ds->rawDataSource;
+	guint num_attr, i;
+	PersonUpdate update;
+	GSList *groups;
+	gboolean changed = FALSE;
+
+	/* the person is in its groups through its addresses, look them up
+	   before those are merged */
+	groups = opensync_index_get_groups(item, ds);
+
+	memset(&update, 0, sizeof(update));
+	email_merge_begin(&update.emails, item);
+
+	/* We won't be treating the UID here. */
+	num_attr = vformat_get_n_attributes(vformat);
+	for (i = 0; i < num_attr; i++) {
 		VFormatAttribute *attr;
-		const char *attr_name;
+		const PersonFieldMap *field;
+
+		attr = vformat_get_nth_attribute(vformat, i);
+		field = person_field_lookup(vformat_attribute_get_atom(attr));
+		if (field && field->import_field)
+			field->import_field(&update, attr);
+	}
 
-		attr = walk->data;
-		attr_name = vformat_attribute_get_name(attr);
+	if(update.last_name && !str_equal_null(item->lastName, update.last_name)) {
+		changed = TRUE;
+		if(apply)
+			addritem_person_set_last_name(item, update.last_name);
+	}
+	if(update.first_name &&
+		 !str_equal_null(item->firstName, update.first_name)) {
+		changed = TRUE;
+		if(apply)
+			addritem_person_set_first_name(item, update.first_name);
+	}
+	if(update.common_name &&
+		 !str_equal_null(ADDRITEM_NAME(item), update.common_name)) {
+		changed = TRUE;
+		if(apply)
+			addritem_person_set_common_name(item, update.common_name);
+	}
+	if(update.nick_name &&
+		 !str_equal_null(item->nickName ? item->nickName : "", update.nick_name)) {
+		changed = TRUE;
+		if(apply)
+			addritem_person_set_nick_name(item, update.nick_name);
+	}
+	g_free(update.common_name);
+
+	/* if no internet mails were included, keep the old email list.
+		 Otherwise, the left-overs are deleted entries. */
+	if(email_merge_finish(&update.emails, abf, item, groups,
+												update.numEmail == 0, apply))
+		changed = TRUE;
+
+	if(person_update_attribs(&update, abf, item, apply))
+		changed = TRUE;
+	if(update.attribs)
+		g_ptr_array_free(update.attribs, TRUE);
+
+	if(person_update_groups(&update, ds, item, groups, apply))
+		changed = TRUE;
+	if(update.categories) {
+		g_ptr_array_foreach(update.categories, (GFunc)g_free, NULL);
+		g_ptr_array_free(update.categories, TRUE);
+	}
+	g_slist_free(groups);
 
-		/* We won't be treating the UID here. */
+	if(changed && apply) {
+		item->status = UPDATE_ENTRY;
+		addrbook_set_dirty(abf,TRUE);
+	}
 
-		/* Name */
-		if (!strcmp(attr_name, "N")) {
-			const gchar *first_name;
-			const gchar *last_name;
-			gchar *display_name;
+	return changed;
+}
 
-			last_name = vformat_attribute_get_nth_value(attr,0);
-			first_name = vformat_attribute_get_nth_value(attr, 1);
+static UserAttribute* attrib_new(const gchar *name, const gchar *value)
+{
+	UserAttribute *attrib;
 
-			if(last_name)
-				addritem_person_set_last_name(item, last_name);
-			if(first_name)
-				addritem_person_set_first_name(item, first_name);
+	attrib = addritem_create_attribute();
+	addritem_attrib_set_name(attrib, name);
+	addritem_attrib_set_value(attrib, value);
+	return attrib;
+}
 
-			if(last_name || first_name) {
-				display_name = g_strdup_printf("%s %s",
-																			 first_name?first_name:"",
-																			 last_name?last_name:"");
-				addritem_person_set_common_name(item, display_name);
-				g_free(display_name);
+/* Birthday and Notes take the values of BDAY and NOTE if the vCard has
+   them, the other user attributes are replaced by the X-CLAWS-ATTRIBUTEs
+   if it has any.  Attributes that stay as they are are reused, the order
+   of the list does not matter.  Returns whether anything differed. */
+static gboolean person_update_attribs(PersonUpdate *update,
+																			AddressBookFile *abf, ItemPerson *item,
+																			gboolean apply)
+{
+	GList *attribs = NULL, *created = NULL, *dropped = NULL, *walk;
+	UserAttribute **reused = NULL;
+	gboolean birthday_seen = FALSE, notes_seen = FALSE;
+	gboolean changed;
+	guint i;
+
+	if (update->attribs)
+		reused = g_new0(UserAttribute*, update->attribs->len / 2);
+
+	for (walk = item->listAttrib; walk; walk = walk->next) {
+		UserAttribute *attrib = walk->data;
+		const gchar *value;
+		gboolean *seen;
+
+		if (str_equal_null(attrib->name, ATTRIB_BIRTHDAY)) {
+			value = update->birthday;
+			seen = &birthday_seen;
+		}
+		else if (str_equal_null(attrib->name, ATTRIB_NOTES)) {
+			value = update->notes;
+			seen = &notes_seen;
+		}
+		else {
+			if (!update->attribs)
+				attribs = g_list_prepend(attribs, attrib);
+			else {
+				/* reused if the vCard has it unchanged */
+				for (i = 0; i < update->attribs->len; i += 2) {
+					if (!reused[i/2] &&
+							str_equal_null(attrib->name,
+														 g_ptr_array_index(update->attribs, i)) &&
+							str_equal_null(attrib->value ? attrib->value : "",
+														 g_ptr_array_index(update->attribs, i+1)))
+						break;
+				}
+				if (i < update->attribs->len)
+					reused[i/2] = attrib;
+				else
+					dropped = g_list_prepend(dropped, attrib);
 			}
+			continue;
 		}
 
-		/* display name */
-		else if (!strcmp(attr_name, "FN")) {
-			const gchar *display_name;
+		if (!value)
+			attribs = g_list_prepend(attribs, attrib);
+		else if (*seen || !str_equal_null(attrib->value, value))
+			dropped = g_list_prepend(dropped, attrib);
+		else {
+			*seen = TRUE;
+			attribs = g_list_prepend(attribs, attrib);
+		}
+	}
 
-			display_name = vformat_attribute_get_nth_value(attr,0);
-			addritem_person_set_common_name(item, display_name?display_name:"");
+	if (update->birthday && !birthday_seen)
+		created = g_list_prepend(created,
+														 attrib_new(ATTRIB_BIRTHDAY, update->birthday));
+	if (update->notes && !notes_seen)
+		created = g_list_prepend(created, attrib_new(ATTRIB_NOTES, update->notes));
+	if (update->attribs) {
+		for (i = 0; i < update->attribs->len; i += 2) {
+			if (reused[i/2])
+				attribs = g_list_prepend(attribs, reused[i/2]);
+			else
+				created = g_list_prepend(created,
+																 attrib_new(g_ptr_array_index(update->attribs, i),
+																						g_ptr_array_index(update->attribs, i+1)));
 		}
+		g_free(reused);
+	}
 
-		/* Internet EMail addresses */
-		else if (!strcmp(attr_name, "EMAIL")) {
-			if (!vformat_attribute_is_single_valued(attr))
-				g_print("Error: EMAIL is supposed to be single valued\n");
-			else {
-				GList *paramList, *paramWalk;
-				numEmail++;
-				paramList = vformat_attribute_get_params(attr);
-				if (!paramList) {
-					/* INTERNET is default */
-					const gchar *email;
-					email = vformat_attribute_get_nth_value(attr, 0);
-					savedMailList = restore_or_add_email_address(abf, item,
-																											 savedMailList,email);
-				}
-				else {
-					for (paramWalk = paramList; paramWalk; paramWalk = paramWalk->next) {
-						VFormatParam *param;
-						param = paramWalk->data;
-						if (param && param->name && param->values && param->values->data &&
-								!strcmp(param->name, "TYPE") &&
-								(!strcmp((char*)param->values->data, "INTERNET") ||
-								 /* Evolution may also put HOME or WORK, though I don't
-									* think this is legal. */
-								 !strcmp((char*)param->values->data, "HOME") ||
-								 !strcmp((char*)param->values->data, "WORK"))) {
-							const gchar *email;
-							email = vformat_attribute_get_nth_value(attr, 0);
-							savedMailList = restore_or_add_email_address(abf, item,
-																													 savedMailList,
-																													 email);
-						}
-					}
-				}
+	changed = (created || dropped);
+	if (changed && apply) {
+		for (walk = created; walk; walk = walk->next)
+			addrcache_id_attribute(abf->addressCache, walk->data);
+		for (walk = dropped; walk; walk = walk->next)
+			addritem_free_attribute(walk->data);
+		g_list_free(item->listAttrib);
+		item->listAttrib = g_list_concat(g_list_reverse(attribs),
+																		 g_list_reverse(created));
+	}
+	else {
+		for (walk = created; walk; walk = walk->next)
+			addritem_free_attribute(walk->data);
+		g_list_free(created);
+		g_list_free(attribs);
+	}
+	g_list_free(dropped);
+
+	return changed;
+}
+
+/* A person is in a group through its addresses.  It joins the groups
+   named in the CATEGORIES of the vCard with its first address, which a
+   person without addresses cannot, and leaves its other groups with all
+   of them.  Groups that do not exist yet are created at the top of the
+   address book.  Without CATEGORIES the groups are left alone.  @groups
+   are the ones the person was in before its addresses were merged.
+   Returns whether anything differed. */
+static gboolean person_update_groups(PersonUpdate *update,
+																		 AddressDataSource *ds, ItemPerson *item,
+																		 GSList *groups, gboolean apply)
+{
+	GSList *stay = NULL, *leave = NULL, *walk;
+	GPtrArray *join;
+	gboolean changed;
+	guint i, j;
+
+	for (walk = groups; walk; walk = walk->next) {
+		ItemGroup *group = walk->data;
+
+		/* it may have lost the addresses it was in there with */
+		if (!person_in_group(item, group))
+			continue;
+
+		if (update->categories) {
+			for (i = 0; i < update->categories->len; i++) {
+				if (str_equal_null(ADDRITEM_NAME(group),
+													 g_ptr_array_index(update->categories, i)))
+					break;
 			}
-		} /* INTERNET Email addresses */
+			if (i == update->categories->len) {
+				leave = g_slist_prepend(leave, group);
+				continue;
+			}
+		}
+		stay = g_slist_prepend(stay, group);
+	}
 
-	} /* for all attributes */
+	join = g_ptr_array_new();
+	for (i = 0; item->listEMail && update->categories &&
+				 (i < update->categories->len); i++) {
+		const gchar *name = g_ptr_array_index(update->categories, i);
 
-	/* if no mails were included, keep the old email list */
-	if(numEmail > 0) {
-		while(savedMailList) {
-			ItemEMail *emailItem;
-			emailItem = savedMailList->data;
-			savedMailList = restore_or_add_email_address(abf, item, savedMailList,
-																									 emailItem->address);
+		for (walk = stay; walk; walk = walk->next) {
+			if (str_equal_null(ADDRITEM_NAME(walk->data), name))
+				break;
 		}
+		for (j = 0; j < join->len; j++) {
+			if (!strcmp(g_ptr_array_index(join, j), name))
+				break;
+		}
+		if (!walk && (j == join->len))
+			g_ptr_array_add(join, (gpointer)name);
 	}
 
-	/* savedMailList now contains the left-overs. Free it.
-		 (if the sync went well, those are deleted entries) */
-	for (emailWalk = savedMailList; emailWalk; emailWalk = emailWalk->next) {
-		ItemEMail *itemEMail;
-		itemEMail = emailWalk->data;
-		addritem_free_item_email(itemEMail);
+	changed = (leave || join->len);
+	if (changed && apply) {
+		AddressBookFile *abf = ds->rawDataSource;
+		/* join is empty for a person without addresses */
+		ItemEMail *email = item->listEMail ? item->listEMail->data : NULL;
+
+		for (walk = leave; walk; walk = walk->next) {
+			GList *ewalk;
+
+			for (ewalk = item->listEMail; ewalk; ewalk = ewalk->next)
+				addritem_group_remove_email(walk->data, ewalk->data);
+		}
+		for (i = 0; email && (i < join->len); i++) {
+			const gchar *name = g_ptr_array_index(join, i);
+			ItemGroup *group;
+
+			group = opensync_index_find_group(name, ds);
+			if (group)
+				addritem_group_add_email(group, email);
+			else {
+				group = addrbook_add_group_list(abf, NULL, g_list_append(NULL, email));
+				addritem_group_set_name(group, name);
+			}
+			stay = g_slist_prepend(stay, group);
+		}
 	}
-	g_list_free(savedMailList);
+	/* the merge may have changed the groups, too */
+	if (apply)
+		opensync_index_set_groups(item, ds, stay);
+
+	g_ptr_array_free(join, TRUE);
+	g_slist_free(leave);
+	g_slist_free(stay);
+
+	return changed;
+}
 
-	item->status = UPDATE_ENTRY;
-	addrbook_set_dirty(abf,TRUE);
+/* whether one of the addresses of @item is in @group */
+static gboolean person_in_group(ItemPerson *item, ItemGroup *group)
+{
+	GList *walk;
+
+	for (walk = group->listEMail; walk; walk = walk->next) {
+		if (ADDRITEM_PARENT(walk->data) == ADDRITEM_OBJECT(item))
+			return TRUE;
+	}
+	return FALSE;
 }
 
-static gchar* get_next_contact(void)
+static VFormat* get_next_contact(void)
 {
 	char *line;
-	char *vcard;
-	char *vcard_tmp;
+	VFormatParser *parser;
 	gboolean complete = FALSE;
 
-	vcard = g_strdup("");
+	parser = vformat_parser_new();
 	while (!complete && ((line = sock_get_next_line(answer_sock)) != NULL)) {
 		if (g_str_has_prefix(line, ":done:")) {
-			g_free(vcard);
-			vcard = NULL;
-			break;
+			vformat_parser_free(parser);
+			return NULL;
 		}
 		else if (g_str_has_prefix(line, ":start_contact:")) {
 			continue;
@@ -646,13 +1975,11 @@ static gchar* get_next_contact(void)
 			continue;
 		}
 
-		/* append line to vcard string */
-		vcard_tmp = vcard;
-		vcard = g_strconcat(vcard_tmp, line, NULL);
-		g_free(vcard_tmp);
+		/* hand the line to the parser, no need to keep the card text */
+		vformat_parser_feed(parser, line, strlen(line));
 	};
 
-	return vcard;
+	return vformat_parser_finish(parser);
 }
 
 static char* sock_get_next_line(int fd)
@@ -682,61 +2009,130 @@ static char* sock_get_next_line(int fd)
 	return buf;
 }
 
-static GList* restore_or_add_email_address(AddressBookFile *abf,
-																					 ItemPerson *item, GList *savedList,
-																					 const gchar *email)
+static void email_merge_begin(EmailMerge *merge, ItemPerson *item)
 {
-	ItemEMail *itemMail = NULL;
 	GList *walk;
-	gboolean found;
-	gchar *addr;
-
-	if(!email)
-		return savedList;
-
-	found = FALSE;
-	for (walk = savedList; walk; walk = walk->next) {
-		itemMail = walk->data;
-		if(itemMail && itemMail->address) {
-			addr = g_strchomp(g_strdup(itemMail->address));
-			if (!strcmp(addr, email))
-				found = TRUE;
+
+	merge->saved = g_list_copy(item->listEMail);
+	merge->emails = NULL;
+	merge->created = NULL;
+	merge->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+																			 (GDestroyNotify)g_queue_free);
+
+	for (walk = merge->saved; walk; walk = walk->next) {
+		ItemEMail *itemMail = walk->data;
+		GQueue *queue;
+		gchar *addr;
+
+		if (!itemMail->address)
+			continue;
+
+		addr = g_strchomp(g_strdup(itemMail->address));
+		queue = g_hash_table_lookup(merge->index, addr);
+		if (queue)
 			g_free(addr);
-			if (found)
-				break;
+		else {
+			queue = g_queue_new();
+			g_hash_table_insert(merge->index, addr, queue);
 		}
+		g_queue_push_tail(queue, walk);
 	}
+}
+
+/* reuses the saved address @email, or creates a new one */
+static void email_merge_add(EmailMerge *merge, const gchar *email)
+{
+	ItemEMail *itemMail;
+	GQueue *queue;
+	GList *link = NULL;
+
+	queue = g_hash_table_lookup(merge->index, email);
+	if (queue)
+		link = g_queue_pop_head(queue);
 
-	if (found) {
-		addritem_person_add_email(item, itemMail);
-		savedList = g_list_delete_link(savedList, walk);
+	if (link) {
+		itemMail = link->data;
+		link->data = NULL;
 	}
-	/* something's fishy here */
 	else {
-		ItemEMail *newEMail;
-		newEMail = addritem_create_item_email();
-		addritem_email_set_address(newEMail, email);
-		addrcache_id_email(abf->addressCache, newEMail);
-		addritem_person_add_email(item, newEMail);
-		addrbook_set_dirty(abf,TRUE);
+		itemMail = addritem_create_item_email();
+		addritem_email_set_address(itemMail, email);
+		merge->created = g_list_prepend(merge->created, itemMail);
+	}
+
+	merge->emails = g_list_prepend(merge->emails, itemMail);
+}
+
+/* the saved addresses that were not reused are kept, or deleted and
+   taken out of @groups, the person's groups.  If the new list differs
+   from the person's one and @apply is set, it replaces it.  Returns
+   whether the lists differ. */
+static gboolean email_merge_finish(EmailMerge *merge, AddressBookFile *abf,
+																	 ItemPerson *item, GSList *groups,
+																	 gboolean keep_leftovers, gboolean apply)
+{
+	GList *emails, *walk, *old;
+	gboolean changed;
+
+	if (keep_leftovers) {
+		for (walk = merge->saved; walk; walk = walk->next)
+			if (walk->data)
+				merge->emails = g_list_prepend(merge->emails, walk->data);
+	}
+	emails = g_list_reverse(merge->emails);
+
+	/* unchanged if the same ItemEMails are left, in the same order */
+	walk = emails;
+	old = item->listEMail;
+	while (walk && old && (walk->data == old->data)) {
+		walk = walk->next;
+		old = old->next;
+	}
+	changed = (walk || old);
+
+	if (changed && apply) {
+		for (walk = merge->created; walk; walk = walk->next)
+			addrcache_id_email(abf->addressCache, walk->data);
+		if (!keep_leftovers) {
+			for (walk = merge->saved; walk; walk = walk->next) {
+				GSList *group;
+
+				if (!walk->data)
+					continue;
+				for (group = groups; group; group = group->next)
+					addritem_group_remove_email(group->data, walk->data);
+				addritem_free_item_email(walk->data);
+			}
+		}
+		for (walk = emails; walk; walk = walk->next)
+			ADDRITEM_PARENT(walk->data) = ADDRITEM_OBJECT(item);
+		g_list_free(item->listEMail);
+		item->listEMail = emails;
+	}
+	else {
+		for (walk = merge->created; walk; walk = walk->next)
+			addritem_free_item_email(walk->data);
+		g_list_free(emails);
 	}
 
-	return savedList;
+	g_list_free(merge->created);
+	g_list_free(merge->saved);
+	g_hash_table_destroy(merge->index);
+
+	return changed;
 }
 
 static gchar* get_next_event(void)
 {
 	char *line;
-	char *vevent;
-	char *vevent_tmp;
+	GString *vevent;
 	gboolean complete = FALSE;
 
-	vevent = g_strdup("");
+	vevent = g_string_new("");
 	while (!complete && ((line = sock_get_next_line(answer_sock)) != NULL)) {
 		if (g_str_has_prefix(line, ":done:")) {
-			g_free(vevent);
-			vevent = NULL;
-			break;
+			g_string_free(vevent, TRUE);
+			return NULL;
 		}
 		else if (g_str_has_prefix(line, ":start_event:")) {
 			continue;
@@ -747,20 +2143,32 @@ static gchar* get_next_event(void)
 		}
 
 		/* append line to vevent string */
-		vevent_tmp = vevent;
-		vevent = g_strconcat(vevent_tmp, line, NULL);
-		g_free(vevent_tmp);
+		g_string_append(vevent, line);
 	};
 
-	return vevent;
+	return g_string_free(vevent, FALSE);
 }
 
 static void received_events_request(gint fd)
 {
 	g_print("Sending events\n");
-	vcal_foreach_event(event_send_cb);
-	sock_send(fd, ":done:\n");
-	g_print("Sending of events done\n");
+
+	/* the vCalendar plugin hands them out in one go */
+	export_items = g_ptr_array_new();
+	vcal_foreach_event(event_export_add);
+	export_start(export_items, event_export_send, g_free, "events");
+	export_items = NULL;
+}
+
+static gboolean event_export_add(const gchar *vevent)
+{
+	g_ptr_array_add(export_items, g_strdup(vevent));
+	return FALSE;
+}
+
+static gboolean event_export_send(gpointer vevent)
+{
+	return event_send_cb(vevent);
 }
 
 static void received_event_modify_request(gint fd)
@@ -784,8 +2192,8 @@ static void received_event_modify_request(gint fd)
 				g_free(msg);
 			}
 			if((!opensync_config.event_ask_modify) || (val != G_ALERTDEFAULT)) {
-				gchar *vevent = g_strdup("");
-				gchar *tmp;
+				GString *vevent_str = g_string_new("");
+				gchar *vevent;
 				gboolean done = FALSE;
 
 				while(!done) {
@@ -795,12 +2203,10 @@ static void received_event_modify_request(gint fd)
 					}
 					if(g_str_has_prefix(buf,":done:"))
 						done = TRUE;
-					else {
-						tmp = vevent;
-						vevent = g_strconcat(tmp,buf,NULL);
-						g_free(tmp);
-					}
+					else
+						g_string_append(vevent_str, buf);
 				}
+				vevent = g_string_free(vevent_str, FALSE);
 				g_print("Modification to: '%s'\n", vevent);
 				if((new_vevent = vcal_update_event(vevent)) != NULL)
 					g_print("event updated successfully\n");
@@ -905,15 +2311,18 @@ static void received_event_add_request(gint fd)
 	g_free(vevent);
 }
 
+/* FALSE if the socket failed */
 static gboolean event_send_cb(const gchar *vevent)
 {
+	gboolean sent;
+
 	g_print("send: event: %s", vevent);
-	sock_send(answer_sock, ":start_event:\n");
+	sent = sock_send(answer_sock, ":start_event:\n");
 	/* make sure the events ends with a line feed */
-	sock_send(answer_sock, vevent);
-	if(vevent[strlen(vevent)-1] != '\n')
-		sock_send(answer_sock, "\n");
-	sock_send(answer_sock, ":end_event:\n");
+	sent = sent && sock_send(answer_sock, vevent);
+	if(sent && (vevent[strlen(vevent)-1] != '\n'))
+		sent = sock_send(answer_sock, "\n");
+	sent = sent && sock_send(answer_sock, ":end_event:\n");
 
-	return FALSE;
+	return sent;
 }
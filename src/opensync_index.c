@@ -0,0 +1,859 @@
+/* OpenSync plugin for Claws Mail
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "pluginconfig.h"
+
+#include "opensync_index.h"
+
+#include "addrbook.h"
+#include "addrcache.h"
+#include "vcard.h"
+
+#include <string.h>
+
+typedef struct
+{
+	ItemPerson *person;    /* only used as a key, never dereferenced */
+	AddressDataSource *ds;
+	gchar *uid;
+	gchar *name;           /* normalized, NULL if empty */
+	GSList *emails;        /* normalized */
+	GPtrArray *terms;      /* normalized strings for the substring search */
+} IndexEntry;
+
+/* the search looks at the candidates of the rarest trigram of the text */
+typedef struct
+{
+	const gchar *text;
+	GPtrArray *prefix_hits;  /* IndexEntry*, a term starts with text */
+	GPtrArray *other_hits;   /* IndexEntry*, a term contains text */
+} SearchData;
+
+/* the groups of one address book.  Groups are kept by their UIDs and
+   looked up in the book's cache when asked for. */
+typedef struct
+{
+	GHashTable *by_person; /* person UID -> GQueue of group UIDs */
+	GHashTable *by_name;   /* group name -> group UID */
+	guint stamp;           /* group_index_stamp() when built */
+	guint checked;         /* group_check_serial when stamp was compared */
+} GroupIndex;
+
+#define TRIGRAM(p) GUINT_TO_POINTER(((guint)(guchar)(p)[0] << 16) | \
+                                    ((guint)(guchar)(p)[1] << 8) | \
+                                    (guint)(guchar)(p)[2])
+
+static gchar*      normalize_email(const gchar*);
+static gchar*      normalize_name(const gchar*);
+static void        index_entry_free(IndexEntry*);
+static void        index_table_add(GHashTable*, const gchar*, IndexEntry*);
+static void        index_table_remove(GHashTable*, const gchar*, IndexEntry*);
+static ItemPerson* index_entry_get_person(IndexEntry*);
+static gboolean    person_has_email(ItemPerson*, const gchar*);
+static gboolean    person_has_name(ItemPerson*, const gchar*);
+static void        index_entry_add_term(IndexEntry*, gchar*);
+static void        index_trigrams_add(IndexEntry*);
+static void        index_trigrams_remove(IndexEntry*);
+static void        search_entry(gpointer, gpointer, gpointer);
+static gboolean    person_matches(ItemPerson*, const gchar*);
+static GroupIndex* group_index_get(AddressDataSource*);
+static void        group_index_free(GroupIndex*);
+static void        group_index_add_group(GroupIndex*, ItemGroup*);
+static ItemGroup*  group_index_get_group(AddressDataSource*, const gchar*);
+static guint       group_index_stamp(GList*);
+static gboolean    group_check_next(gpointer);
+static void        uid_queue_free(GQueue*);
+
+static GHashTable *index_by_person = NULL; /* ItemPerson* -> IndexEntry* */
+static GHashTable *index_by_email = NULL;  /* address -> GQueue of IndexEntry* */
+static GHashTable *index_by_name = NULL;   /* name -> GQueue of IndexEntry* */
+static GHashTable *index_by_trigram = NULL;
+	/* three bytes of a term -> set of IndexEntry* */
+static GHashTable *group_index_by_ds = NULL;
+	/* AddressDataSource* -> GroupIndex* */
+/* The GUI can only edit groups between main loop iterations, so the
+   groups of a book are compared with its index once per iteration.  An
+   idle source of high priority starts the next one. */
+static guint group_check_serial = 1;
+static guint group_check_source = 0;
+
+gboolean opensync_index_exists(void)
+{
+	return index_by_person != NULL;
+}
+
+void opensync_index_create(void)
+{
+	if (index_by_person)
+		return;
+
+	index_by_person = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+																					(GDestroyNotify)index_entry_free);
+	index_by_email = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+																				 (GDestroyNotify)g_queue_free);
+	index_by_name = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+																				(GDestroyNotify)g_queue_free);
+	index_by_trigram = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+																					 NULL,
+																					 (GDestroyNotify)g_hash_table_destroy);
+}
+
+void opensync_index_clear(void)
+{
+	if (group_index_by_ds) {
+		g_hash_table_destroy(group_index_by_ds);
+		group_index_by_ds = NULL;
+	}
+	if (group_check_source) {
+		g_source_remove(group_check_source);
+		group_check_source = 0;
+	}
+
+	if (!index_by_person)
+		return;
+
+	/* the tables only point to the entries */
+	g_hash_table_destroy(index_by_email);
+	g_hash_table_destroy(index_by_name);
+	g_hash_table_destroy(index_by_trigram);
+	g_hash_table_destroy(index_by_person);
+	index_by_email = NULL;
+	index_by_name = NULL;
+	index_by_trigram = NULL;
+	index_by_person = NULL;
+}
+
+void opensync_index_add_person(ItemPerson *person, AddressDataSource *ds)
+{
+	IndexEntry *entry;
+	GList *walk;
+	GSList *swalk;
+
+	if (!index_by_person || !ds || (ds->type != ADDR_IF_BOOK))
+		return;
+
+	opensync_index_remove_person(person);
+
+	entry = g_new0(IndexEntry, 1);
+	entry->person = person;
+	entry->ds = ds;
+	entry->uid = g_strdup(ADDRITEM_ID(person));
+	entry->name = normalize_name(ADDRITEM_NAME(person));
+	for (walk = person->listEMail; walk; walk = walk->next) {
+		gchar *email;
+		email = normalize_email(((ItemEMail*)walk->data)->address);
+		if (email)
+			entry->emails = g_slist_prepend(entry->emails, email);
+	}
+
+	entry->terms = g_ptr_array_new();
+	index_entry_add_term(entry, g_strdup(entry->name));
+	index_entry_add_term(entry, normalize_name(person->firstName));
+	index_entry_add_term(entry, normalize_name(person->lastName));
+	index_entry_add_term(entry, normalize_name(person->nickName));
+	for (swalk = entry->emails; swalk; swalk = swalk->next)
+		index_entry_add_term(entry, g_strdup(swalk->data));
+
+	g_hash_table_insert(index_by_person, person, entry);
+	if (entry->name)
+		index_table_add(index_by_name, entry->name, entry);
+	for (swalk = entry->emails; swalk; swalk = swalk->next)
+		index_table_add(index_by_email, swalk->data, entry);
+	index_trigrams_add(entry);
+}
+
+void opensync_index_remove_person(ItemPerson *person)
+{
+	IndexEntry *entry;
+	GSList *walk;
+
+	if (!index_by_person)
+		return;
+
+	entry = g_hash_table_lookup(index_by_person, person);
+	if (!entry)
+		return;
+
+	if (entry->name)
+		index_table_remove(index_by_name, entry->name, entry);
+	for (walk = entry->emails; walk; walk = walk->next)
+		index_table_remove(index_by_email, walk->data, entry);
+	index_trigrams_remove(entry);
+	g_hash_table_remove(index_by_person, person);
+}
+
+ItemPerson* opensync_index_find_duplicate(const gchar *name, GPtrArray *emails,
+																					AddressDataSource **ds)
+{
+	ItemPerson *found = NULL;
+	gchar *key;
+	guint i;
+
+	if (!index_by_person)
+		return NULL;
+
+	/* same name and a common address */
+	for (i = 0; !found && (i < emails->len); i++) {
+		GQueue *queue;
+		GList *walk;
+
+		key = normalize_email(g_ptr_array_index(emails, i));
+		queue = key ? g_hash_table_lookup(index_by_email, key) : NULL;
+		for (walk = queue ? queue->head : NULL; walk; walk = walk->next) {
+			IndexEntry *entry = walk->data;
+			ItemPerson *person;
+
+			person = index_entry_get_person(entry);
+			if (person && person_has_email(person, key) &&
+					person_has_name(person, name)) {
+				found = person;
+				*ds = entry->ds;
+				break;
+			}
+		}
+		g_free(key);
+	}
+
+	/* same name and no addresses */
+	if (!found && !emails->len && (key = normalize_name(name)) != NULL) {
+		GQueue *queue;
+		GList *walk;
+
+		queue = g_hash_table_lookup(index_by_name, key);
+		for (walk = queue ? queue->head : NULL; walk; walk = walk->next) {
+			IndexEntry *entry = walk->data;
+			ItemPerson *person;
+
+			person = index_entry_get_person(entry);
+			if (person && !person->listEMail && person_has_name(person, name)) {
+				found = person;
+				*ds = entry->ds;
+				break;
+			}
+		}
+		g_free(key);
+	}
+
+	return found;
+}
+
+ItemPerson* opensync_index_find_email(const gchar *email,
+																			AddressDataSource **ds)
+{
+	ItemPerson *found = NULL;
+	GQueue *queue;
+	GList *walk;
+	gchar *key;
+
+	if (!index_by_person)
+		return NULL;
+
+	key = normalize_email(email);
+	queue = key ? g_hash_table_lookup(index_by_email, key) : NULL;
+	for (walk = queue ? queue->head : NULL; walk; walk = walk->next) {
+		IndexEntry *entry = walk->data;
+		ItemPerson *person;
+
+		person = index_entry_get_person(entry);
+		if (person && person_has_email(person, key)) {
+			found = person;
+			*ds = entry->ds;
+			break;
+		}
+	}
+	g_free(key);
+
+	return found;
+}
+
+GArray* opensync_index_search(const gchar *text, guint limit)
+{
+	GArray *hits;
+	SearchData data;
+	gchar *norm;
+	guint i;
+
+	hits = g_array_new(FALSE, FALSE, sizeof(OpenSyncIndexHit));
+	if (!index_by_person || !limit || !(norm = normalize_name(text)))
+		return hits;
+
+	data.text = norm;
+	data.prefix_hits = g_ptr_array_new();
+	data.other_hits = g_ptr_array_new();
+
+	if (strlen(norm) < 3)
+		/* too short for trigrams, look at every contact */
+		g_hash_table_foreach(index_by_person, search_entry, &data);
+	else {
+		GHashTable *rarest = NULL;
+		const gchar *p;
+
+		for (p = norm; p[1] && p[2]; p++) {
+			GHashTable *set;
+
+			set = g_hash_table_lookup(index_by_trigram, TRIGRAM(p));
+			if (!set) {
+				rarest = NULL;
+				break;
+			}
+			if (!rarest || (g_hash_table_size(set) < g_hash_table_size(rarest)))
+				rarest = set;
+		}
+		if (rarest)
+			g_hash_table_foreach(rarest, search_entry, &data);
+	}
+
+	/* the persons may have been changed in the GUI meanwhile */
+	for (i = 0; (hits->len < limit) &&
+				 (i < data.prefix_hits->len + data.other_hits->len); i++) {
+		IndexEntry *entry;
+		OpenSyncIndexHit hit;
+
+		if (i < data.prefix_hits->len)
+			entry = g_ptr_array_index(data.prefix_hits, i);
+		else
+			entry = g_ptr_array_index(data.other_hits, i - data.prefix_hits->len);
+
+		hit.person = index_entry_get_person(entry);
+		hit.ds = entry->ds;
+		if (hit.person && person_matches(hit.person, norm))
+			g_array_append_val(hits, hit);
+	}
+
+	g_ptr_array_free(data.prefix_hits, TRUE);
+	g_ptr_array_free(data.other_hits, TRUE);
+	g_free(norm);
+
+	return hits;
+}
+
+GSList* opensync_index_get_groups(ItemPerson *person, AddressDataSource *ds)
+{
+	GroupIndex *index;
+	GQueue *queue;
+	GList *walk;
+	GSList *groups = NULL;
+
+	index = group_index_get(ds);
+	queue = index ? g_hash_table_lookup(index->by_person, ADDRITEM_ID(person))
+		: NULL;
+	for (walk = queue ? queue->head : NULL; walk; walk = walk->next) {
+		ItemGroup *group;
+
+		group = group_index_get_group(ds, walk->data);
+		if (group)
+			groups = g_slist_prepend(groups, group);
+	}
+
+	return g_slist_reverse(groups);
+}
+
+ItemGroup* opensync_index_find_group(const gchar *name, AddressDataSource *ds)
+{
+	GroupIndex *index;
+	ItemGroup *group;
+	const gchar *uid;
+
+	index = group_index_get(ds);
+	uid = (index && name) ? g_hash_table_lookup(index->by_name, name) : NULL;
+	if (!uid)
+		return NULL;
+
+	/* it may have been renamed in the GUI meanwhile */
+	group = group_index_get_group(ds, uid);
+	if (!group || !ADDRITEM_NAME(group) || strcmp(ADDRITEM_NAME(group), name))
+		return NULL;
+
+	return group;
+}
+
+void opensync_index_set_groups(ItemPerson *person, AddressDataSource *ds,
+															 GSList *groups)
+{
+	GroupIndex *index;
+	GQueue *queue;
+	GSList *walk;
+	GList *all_groups;
+
+	index = group_index_get(ds);
+	if (!index)
+		return;
+
+	queue = g_queue_new();
+	for (walk = groups; walk; walk = walk->next) {
+		ItemGroup *group = walk->data;
+
+		g_queue_push_tail(queue, g_strdup(ADDRITEM_ID(group)));
+		if (ADDRITEM_NAME(group) &&
+				!g_hash_table_lookup(index->by_name, ADDRITEM_NAME(group)))
+			g_hash_table_insert(index->by_name, g_strdup(ADDRITEM_NAME(group)),
+													g_strdup(ADDRITEM_ID(group)));
+	}
+	g_hash_table_replace(index->by_person, g_strdup(ADDRITEM_ID(person)), queue);
+
+	/* the memberships changed by the caller are known now */
+	all_groups = addrindex_ds_get_all_groups(ds);
+	index->stamp = group_index_stamp(all_groups);
+	g_list_free(all_groups);
+}
+
+gboolean opensync_address_book_is_known(AddressDataSource *ds)
+{
+	GList *nodeIf;
+
+	nodeIf = addrindex_get_interface_list(addrindex_get_object());
+	for (; nodeIf; nodeIf = nodeIf->next) {
+		AddressInterface *iface = nodeIf->data;
+
+		if ((iface->type == ADDR_IF_BOOK) && g_list_find(iface->listSource, ds))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+ItemPerson* opensync_address_book_get_person(AddressDataSource *ds,
+																						 const gchar *uid)
+{
+	AddressBookFile *abf;
+	AddrItemObject *obj;
+
+	if (!opensync_address_book_is_known(ds))
+		return NULL;
+
+	abf = ds->rawDataSource;
+	obj = addrcache_get_object(abf->addressCache, uid);
+	if (!obj || (obj->type != ITEMTYPE_PERSON))
+		return NULL;
+
+	return (ItemPerson*)obj;
+}
+
+gboolean opensync_data_source_is_known(AddressDataSource *ds)
+{
+	GList *nodeIf;
+
+	nodeIf = addrindex_get_interface_list(addrindex_get_object());
+	for (; nodeIf; nodeIf = nodeIf->next) {
+		AddressInterface *iface = nodeIf->data;
+
+		if (g_list_find(iface->listSource, ds))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+ItemPerson* opensync_data_source_get_person(AddressDataSource *ds,
+																						const gchar *uid)
+{
+	AddrItemObject *obj;
+	GList *persons, *walk;
+	ItemPerson *person;
+
+	if (ds->type == ADDR_IF_BOOK)
+		return opensync_address_book_get_person(ds, uid);
+
+	if (!opensync_data_source_is_known(ds) || !ds->rawDataSource)
+		return NULL;
+
+	if (ds->type == ADDR_IF_VCARD) {
+		VCardFile *vcf = ds->rawDataSource;
+
+		obj = addrcache_get_object(vcf->addressCache, uid);
+		if (!obj || (obj->type != ITEMTYPE_PERSON))
+			return NULL;
+		return (ItemPerson*)obj;
+	}
+
+	/* no cache to ask for the others */
+	person = NULL;
+	persons = addrindex_ds_get_all_persons(ds);
+	for (walk = persons; walk; walk = walk->next) {
+		if (!strcmp(ADDRITEM_ID(walk->data), uid)) {
+			person = walk->data;
+			break;
+		}
+	}
+	g_list_free(persons);
+
+	return person;
+}
+
+/* stripped and lower case, NULL if empty */
+static gchar* normalize_email(const gchar *email)
+{
+	gchar *tmp, *norm;
+
+	if (!email)
+		return NULL;
+
+	tmp = g_strstrip(g_strdup(email));
+	if (!*tmp) {
+		g_free(tmp);
+		return NULL;
+	}
+	norm = g_ascii_strdown(tmp, -1);
+	g_free(tmp);
+
+	return norm;
+}
+
+/* case folded, with runs of white space collapsed.  NULL if empty. */
+static gchar* normalize_name(const gchar *name)
+{
+	GString *collapsed;
+	gchar *norm;
+	const gchar *p;
+
+	if (!name)
+		return NULL;
+
+	collapsed = g_string_sized_new(strlen(name));
+	for (p = name; *p; p++) {
+		if (g_ascii_isspace(*p)) {
+			if (collapsed->len && (collapsed->str[collapsed->len-1] != ' '))
+				g_string_append_c(collapsed, ' ');
+		}
+		else
+			g_string_append_c(collapsed, *p);
+	}
+	if (collapsed->len && (collapsed->str[collapsed->len-1] == ' '))
+		g_string_truncate(collapsed, collapsed->len-1);
+
+	if (!collapsed->len)
+		norm = NULL;
+	else if (g_utf8_validate(collapsed->str, collapsed->len, NULL))
+		norm = g_utf8_casefold(collapsed->str, collapsed->len);
+	else
+		norm = g_ascii_strdown(collapsed->str, collapsed->len);
+	g_string_free(collapsed, TRUE);
+
+	return norm;
+}
+
+static void index_entry_free(IndexEntry *entry)
+{
+	GSList *walk;
+
+	for (walk = entry->emails; walk; walk = walk->next)
+		g_free(walk->data);
+	g_slist_free(entry->emails);
+	g_ptr_array_foreach(entry->terms, (GFunc)g_free, NULL);
+	g_ptr_array_free(entry->terms, TRUE);
+	g_free(entry->name);
+	g_free(entry->uid);
+	g_free(entry);
+}
+
+static void index_table_add(GHashTable *table, const gchar *key,
+														IndexEntry *entry)
+{
+	GQueue *queue;
+
+	queue = g_hash_table_lookup(table, key);
+	if (!queue) {
+		queue = g_queue_new();
+		g_hash_table_insert(table, g_strdup(key), queue);
+	}
+	g_queue_push_tail(queue, entry);
+}
+
+static void index_table_remove(GHashTable *table, const gchar *key,
+															 IndexEntry *entry)
+{
+	GQueue *queue;
+
+	queue = g_hash_table_lookup(table, key);
+	if (!queue)
+		return;
+	g_queue_remove(queue, entry);
+	if (g_queue_is_empty(queue))
+		g_hash_table_remove(table, key);
+}
+
+/* the person of @entry, looked up by its UID.  NULL if it is gone. */
+static ItemPerson* index_entry_get_person(IndexEntry *entry)
+{
+	return opensync_address_book_get_person(entry->ds, entry->uid);
+}
+
+/* whether @person still has the normalized address @email */
+static gboolean person_has_email(ItemPerson *person, const gchar *email)
+{
+	GList *walk;
+
+	for (walk = person->listEMail; walk; walk = walk->next) {
+		gchar *norm;
+		gboolean equal;
+
+		norm = normalize_email(((ItemEMail*)walk->data)->address);
+		equal = norm && !strcmp(norm, email);
+		g_free(norm);
+		if (equal)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean person_has_name(ItemPerson *person, const gchar *name)
+{
+	gchar *a, *b;
+	gboolean equal;
+
+	a = normalize_name(ADDRITEM_NAME(person));
+	b = normalize_name(name);
+	equal = (!a && !b) || (a && b && !strcmp(a, b));
+	g_free(a);
+	g_free(b);
+
+	return equal;
+}
+
+/* takes @term, which may be NULL */
+static void index_entry_add_term(IndexEntry *entry, gchar *term)
+{
+	if (term)
+		g_ptr_array_add(entry->terms, term);
+}
+
+static void index_trigrams_add(IndexEntry *entry)
+{
+	guint i;
+
+	for (i = 0; i < entry->terms->len; i++) {
+		const gchar *p;
+
+		for (p = g_ptr_array_index(entry->terms, i); p[0] && p[1] && p[2]; p++) {
+			GHashTable *set;
+
+			set = g_hash_table_lookup(index_by_trigram, TRIGRAM(p));
+			if (!set) {
+				set = g_hash_table_new(g_direct_hash, g_direct_equal);
+				g_hash_table_insert(index_by_trigram, TRIGRAM(p), set);
+			}
+			g_hash_table_insert(set, entry, entry);
+		}
+	}
+}
+
+static void index_trigrams_remove(IndexEntry *entry)
+{
+	guint i;
+
+	for (i = 0; i < entry->terms->len; i++) {
+		const gchar *p;
+
+		for (p = g_ptr_array_index(entry->terms, i); p[0] && p[1] && p[2]; p++) {
+			GHashTable *set;
+
+			set = g_hash_table_lookup(index_by_trigram, TRIGRAM(p));
+			if (!set)
+				continue;
+			g_hash_table_remove(set, entry);
+			if (!g_hash_table_size(set))
+				g_hash_table_remove(index_by_trigram, TRIGRAM(p));
+		}
+	}
+}
+
+static void search_entry(gpointer key, gpointer value, gpointer user_data)
+{
+	IndexEntry *entry = value;
+	SearchData *data = user_data;
+	gboolean contained = FALSE;
+	guint i;
+
+	for (i = 0; i < entry->terms->len; i++) {
+		const gchar *term = g_ptr_array_index(entry->terms, i);
+		const gchar *found;
+
+		found = strstr(term, data->text);
+		if (found == term) {
+			g_ptr_array_add(data->prefix_hits, entry);
+			return;
+		}
+		if (found)
+			contained = TRUE;
+	}
+	if (contained)
+		g_ptr_array_add(data->other_hits, entry);
+}
+
+/* whether one of the searched fields of @person contains @text */
+static gboolean person_matches(ItemPerson *person, const gchar *text)
+{
+	const gchar *names[4];
+	gboolean match = FALSE;
+	GList *walk;
+	guint i;
+
+	names[0] = ADDRITEM_NAME(person);
+	names[1] = person->firstName;
+	names[2] = person->lastName;
+	names[3] = person->nickName;
+	for (i = 0; !match && (i < G_N_ELEMENTS(names)); i++) {
+		gchar *norm;
+		norm = normalize_name(names[i]);
+		match = norm && strstr(norm, text);
+		g_free(norm);
+	}
+	for (walk = person->listEMail; !match && walk; walk = walk->next) {
+		gchar *norm;
+		norm = normalize_email(((ItemEMail*)walk->data)->address);
+		match = norm && strstr(norm, text);
+		g_free(norm);
+	}
+
+	return match;
+}
+
+/* the group index of @ds, built on first use and again when the groups
+   of the book look changed.  NULL if @ds is not an address book
+   (anymore). */
+static GroupIndex* group_index_get(AddressDataSource *ds)
+{
+	GroupIndex *index;
+	GList *groups, *walk;
+	guint stamp;
+
+	if (!ds || !opensync_address_book_is_known(ds))
+		return NULL;
+
+	if (!group_index_by_ds)
+		group_index_by_ds = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+																							NULL,
+																							(GDestroyNotify)group_index_free);
+	index = g_hash_table_lookup(group_index_by_ds, ds);
+	if (index && (index->checked == group_check_serial))
+		return index;
+
+	if (!group_check_source)
+		group_check_source = g_idle_add_full(G_PRIORITY_HIGH, group_check_next,
+																				 NULL, NULL);
+	groups = addrindex_ds_get_all_groups(ds);
+	stamp = group_index_stamp(groups);
+	if (index && (index->stamp == stamp)) {
+		index->checked = group_check_serial;
+		g_list_free(groups);
+		return index;
+	}
+	if (index)
+		g_hash_table_remove(group_index_by_ds, ds);
+
+	index = g_new0(GroupIndex, 1);
+	index->stamp = stamp;
+	index->checked = group_check_serial;
+	index->by_person = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+																					 (GDestroyNotify)uid_queue_free);
+	index->by_name = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+																				 g_free);
+
+	/* one pass over all memberships of the book */
+	for (walk = groups; walk; walk = walk->next)
+		group_index_add_group(index, walk->data);
+	g_list_free(groups);
+
+	g_hash_table_insert(group_index_by_ds, ds, index);
+
+	return index;
+}
+
+static void group_index_free(GroupIndex *index)
+{
+	g_hash_table_destroy(index->by_person);
+	g_hash_table_destroy(index->by_name);
+	g_free(index);
+}
+
+static void group_index_add_group(GroupIndex *index, ItemGroup *group)
+{
+	const gchar *uid = ADDRITEM_ID(group);
+	GList *walk;
+
+	if (ADDRITEM_NAME(group) &&
+			!g_hash_table_lookup(index->by_name, ADDRITEM_NAME(group)))
+		g_hash_table_insert(index->by_name, g_strdup(ADDRITEM_NAME(group)),
+												g_strdup(uid));
+
+	for (walk = group->listEMail; walk; walk = walk->next) {
+		AddrItemObject *person;
+		GQueue *queue;
+
+		person = ADDRITEM_PARENT(walk->data);
+		if (!person || (person->type != ITEMTYPE_PERSON))
+			continue;
+
+		queue = g_hash_table_lookup(index->by_person, person->uid);
+		if (!queue) {
+			queue = g_queue_new();
+			g_hash_table_insert(index->by_person, g_strdup(person->uid), queue);
+		}
+		/* a person may be in the group with several addresses */
+		if (!g_queue_find_custom(queue, uid, (GCompareFunc)strcmp))
+			g_queue_push_tail(queue, g_strdup(uid));
+	}
+}
+
+/* the group of the address book @ds with the UID @uid.  NULL if it is
+   gone. */
+static ItemGroup* group_index_get_group(AddressDataSource *ds,
+																				const gchar *uid)
+{
+	AddressBookFile *abf;
+	AddrItemObject *obj;
+
+	abf = ds->rawDataSource;
+	obj = addrcache_get_object(abf->addressCache, uid);
+	if (!obj || (obj->type != ITEMTYPE_GROUP))
+		return NULL;
+
+	return (ItemGroup*)obj;
+}
+
+static gboolean group_check_next(gpointer data)
+{
+	group_check_serial++;
+	group_check_source = 0;
+	return FALSE;
+}
+
+/* Groups edited in the GUI change this: the number of groups, their
+   names and the addresses in them. */
+static guint group_index_stamp(GList *groups)
+{
+	guint stamp = 0;
+
+	for (; groups; groups = groups->next) {
+		ItemGroup *group = groups->data;
+		GList *walk;
+
+		for (walk = group->listEMail; walk; walk = walk->next)
+			stamp = stamp * 31 + GPOINTER_TO_UINT(walk->data);
+		if (ADDRITEM_NAME(group))
+			stamp = stamp * 31 + g_str_hash(ADDRITEM_NAME(group));
+		stamp++;
+	}
+	return stamp;
+}
+
+static void uid_queue_free(GQueue *queue)
+{
+	g_queue_foreach(queue, (GFunc)g_free, NULL);
+	g_queue_free(queue);
+}
@@ -0,0 +1,108 @@
+/* OpenSync plugin for Claws Mail
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Hash indexes over the contacts of the local address books, keyed on
+ * normalized email addresses and names, a trigram index over their
+ * names, nicknames and addresses for substring search, and for each
+ * address book the groups that each of its contacts is in.
+ *
+ * The index does not own the persons.  It remembers the address book
+ * and UID of each one and looks the person up in the address book's
+ * cache on every hit, checking that it still matches.  Contacts edited
+ * or deleted in the GUI are then at worst not found, the index never
+ * hands out a stale pointer.  The groups of a book are compared with
+ * the index once per main loop iteration and collected again when they
+ * were changed.  The plugin keeps the index up to date for its own
+ * changes and drops it at the end of each sync session. */
+
+#ifndef OPENSYNC_INDEX_H
+#define OPENSYNC_INDEX_H
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include "pluginconfig.h"
+
+#include <glib.h>
+
+#include "addrindex.h"
+#include "addritem.h"
+
+typedef struct
+{
+	ItemPerson *person;
+	AddressDataSource *ds;
+} OpenSyncIndexHit;
+
+/* whether the index exists.  add and remove do nothing before
+   opensync_index_create(). */
+gboolean    opensync_index_exists(void);
+void        opensync_index_create(void);
+void        opensync_index_clear(void);
+
+/* (re-)indexes @person of the address book @ds.  Persons of other data
+   sources than address books are ignored. */
+void        opensync_index_add_person(ItemPerson *person, AddressDataSource *ds);
+void        opensync_index_remove_person(ItemPerson *person);
+
+/* a person that has the display name @name and one of the addresses in
+   @emails, or no addresses at all if @emails is empty.  NULL if there is
+   none. */
+ItemPerson* opensync_index_find_duplicate(const gchar *name, GPtrArray *emails,
+																					AddressDataSource **ds);
+
+/* the first person that has the address @email, or NULL */
+ItemPerson* opensync_index_find_email(const gchar *email, AddressDataSource **ds);
+
+/* up to @limit persons with a display name, first or last name,
+   nickname or address that contains @text, ignoring case.  The ones
+   where one of these starts with @text come first.  Returns a GArray of
+   OpenSyncIndexHit. */
+GArray*     opensync_index_search(const gchar *text, guint limit);
+
+/* the groups of the address book @ds that have one of the addresses of
+   @person, as a list of ItemGroup* to be freed with g_slist_free().  The
+   memberships of a book are collected in one pass over its groups when
+   it is first asked for, whether or not the index was created, and
+   again when its groups were changed since. */
+GSList*     opensync_index_get_groups(ItemPerson *person, AddressDataSource *ds);
+
+/* the group of @ds named @name, or NULL */
+ItemGroup*  opensync_index_find_group(const gchar *name, AddressDataSource *ds);
+
+/* tells the index that @person is now in @groups, ItemGroup*s of @ds.
+   New groups among them can be found by name afterwards. */
+void        opensync_index_set_groups(ItemPerson *person, AddressDataSource *ds,
+																			GSList *groups);
+
+/* whether @ds is still one of the address books */
+gboolean    opensync_address_book_is_known(AddressDataSource *ds);
+
+/* the person with the UID @uid in the address book @ds, or NULL if it or
+   the book is gone */
+ItemPerson* opensync_address_book_get_person(AddressDataSource *ds,
+																						 const gchar *uid);
+
+/* whether @ds is still one of the data sources of any kind */
+gboolean    opensync_data_source_is_known(AddressDataSource *ds);
+
+/* like opensync_address_book_get_person(), but for a local data source
+   of any kind, which may have been re-read or removed since */
+ItemPerson* opensync_data_source_get_person(AddressDataSource *ds,
+																						const gchar *uid);
+
+#endif
@@ -35,9 +35,11 @@ typedef struct
 	GtkWidget *contact_ask_delete;
 	GtkWidget *contact_ask_modify;
 	GtkWidget *addrbook_choice_individual;
+	GtkWidget *addrbook_choice_ask_once;
 	GtkWidget *addrbook_choice_default;
 	GtkWidget *addrbook_default_choice_cont;
 	GtkWidget *addrbook_folderpath;
+	GtkWidget *contact_sync_scope;
 	GtkWidget *event_ask_add;
 	GtkWidget *event_ask_delete;
 	GtkWidget *event_ask_modify;	
@@ -56,6 +58,8 @@ PrefParam opensync_param[] =
 	{	"addrbook_choice", "0", &opensync_config.addrbook_choice, P_INT, NULL, NULL, NULL},
 	{	"addrbook_folderpath", "", &opensync_config.addrbook_folderpath, P_STRING,
 		NULL, NULL, NULL},
+	{	"contact_sync_scope", "", &opensync_config.contact_sync_scope, P_STRING,
+		NULL, NULL, NULL},
 	{ "event_ask_add", "TRUE", &opensync_config.event_ask_add, P_BOOL, NULL, NULL, NULL },
 	{ "event_ask_delete", "TRUE", &opensync_config.event_ask_delete, P_BOOL, NULL, NULL,
 		NULL },
@@ -70,6 +74,7 @@ static void opensync_destroy_prefs_page(PrefsPage*);
 static void opensync_save_prefs(PrefsPage*);
 
 static void select_default_addressbook_clicked(void);
+static void add_sync_scope_clicked(void);
 static void radio_addressbook_choice_toggle(GtkToggleButton*,gpointer);
 
 static gboolean have_calendar_plugin(void);
@@ -137,6 +142,7 @@ static void opensync_create_prefs_page(PrefsPage *page, GtkWindow *window,
 	GtkWidget *hbox2;
 	GtkWidget *entry;
 	GtkWidget *button;
+	GtkWidget *label;
 	GtkWidget *top_frame;
 	GtkWidget *top_vbox;
 
@@ -207,6 +213,16 @@ static void opensync_create_prefs_page(PrefsPage *page, GtkWindow *window,
 		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio), TRUE);
 	opensync_page.addrbook_choice_individual = radio;
 
+	radio = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radio),
+	_("Let me choose once per sync"));
+  g_signal_connect(G_OBJECT(radio), "toggled",
+									 G_CALLBACK(radio_addressbook_choice_toggle),
+									 GINT_TO_POINTER(OPENSYNC_ADDRESS_BOOK_ASK_ONCE));
+	gtk_box_pack_start(GTK_BOX(vbox), radio, FALSE, FALSE, 0);
+	if(opensync_config.addrbook_choice == OPENSYNC_ADDRESS_BOOK_ASK_ONCE)
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio), TRUE);
+	opensync_page.addrbook_choice_ask_once = radio;
+
 	hbox = gtk_hbox_new(FALSE, 20);
 
 	radio = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radio),
@@ -237,6 +253,33 @@ static void opensync_create_prefs_page(PrefsPage *page, GtkWindow *window,
 	radio_addressbook_choice_toggle(GTK_TOGGLE_BUTTON(radio),
 																	GINT_TO_POINTER(OPENSYNC_ADDRESS_BOOK_DEFAULT));
 
+	/* Frame */
+	frame = gtk_frame_new(_("Address books and folders to sync"));
+	gtk_container_set_border_width(GTK_CONTAINER(frame), 10);
+	gtk_box_pack_start(GTK_BOX(top_vbox), frame, FALSE, FALSE, 0);
+
+	/* Frame vbox */
+	vbox = gtk_vbox_new(FALSE, 4);
+	gtk_container_add(GTK_CONTAINER(frame), vbox);
+	gtk_container_set_border_width(GTK_CONTAINER(vbox), 8);
+
+	/* Sync scope */
+	hbox = gtk_hbox_new(FALSE, 20);
+	entry = gtk_entry_new();
+	if(opensync_config.contact_sync_scope)
+		gtk_entry_set_text(GTK_ENTRY(entry), opensync_config.contact_sync_scope);
+	gtk_box_pack_start(GTK_BOX(hbox), entry, TRUE, TRUE, 0);
+	opensync_page.contact_sync_scope = entry;
+	button = gtk_button_new_with_label(_("Add ..."));
+  g_signal_connect(G_OBJECT(button), "clicked",
+									 G_CALLBACK(add_sync_scope_clicked), NULL);
+	gtk_box_pack_start(GTK_BOX(hbox), button, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+	label = gtk_label_new(_("Comma separated list. Leave empty to sync all "
+													"address books."));
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
 	/* Calendar */
 
 	/* Top frame */
@@ -307,6 +350,9 @@ static void opensync_save_prefs(PrefsPage *page)
 	if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON
 																	(opensync_page.addrbook_choice_individual)))
 		opensync_config.addrbook_choice = OPENSYNC_ADDRESS_BOOK_INDIVIDUAL;
+	else if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON
+																	(opensync_page.addrbook_choice_ask_once)))
+		opensync_config.addrbook_choice = OPENSYNC_ADDRESS_BOOK_ASK_ONCE;
 	else if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON
 																	(opensync_page.addrbook_choice_default)))
 		opensync_config.addrbook_choice = OPENSYNC_ADDRESS_BOOK_DEFAULT;
@@ -315,6 +361,10 @@ static void opensync_save_prefs(PrefsPage *page)
 	g_free(opensync_config.addrbook_folderpath);
 	opensync_config.addrbook_folderpath = g_strdup(tmp_str);
 
+	tmp_str = gtk_entry_get_text(GTK_ENTRY(opensync_page.contact_sync_scope));
+	g_free(opensync_config.contact_sync_scope);
+	opensync_config.contact_sync_scope = g_strdup(tmp_str);
+
 	/* calendar */
 	opensync_config.event_ask_add =
 		gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(opensync_page.event_ask_add));
@@ -337,6 +387,25 @@ static void select_default_addressbook_clicked(void)
 	}
 }
 
+static void add_sync_scope_clicked(void)
+{
+	const gchar *scope;
+	gchar *new_path;
+
+	new_path = addressbook_folder_selection(NULL);
+	if(new_path) {
+		gchar *new_scope;
+		scope = gtk_entry_get_text(GTK_ENTRY(opensync_page.contact_sync_scope));
+		if(*scope)
+			new_scope = g_strconcat(scope, ",", new_path, NULL);
+		else
+			new_scope = g_strdup(new_path);
+		gtk_entry_set_text(GTK_ENTRY(opensync_page.contact_sync_scope), new_scope);
+		g_free(new_scope);
+		g_free(new_path);
+	}
+}
+
 /* This is just for sensitivity to stay conform with canceling the dialog */
 static void radio_addressbook_choice_toggle(GtkToggleButton *togglebutton,
 																						gpointer         user_data)
@@ -28,6 +28,7 @@
 typedef enum {
   OPENSYNC_ADDRESS_BOOK_INDIVIDUAL = 0,
   OPENSYNC_ADDRESS_BOOK_DEFAULT,
+  OPENSYNC_ADDRESS_BOOK_ASK_ONCE,
 } OpenSyncAddressBookChoice;
 
 
@@ -37,6 +38,7 @@ typedef struct {
 	gboolean contact_ask_modify;
 	OpenSyncAddressBookChoice addrbook_choice;
 	gchar *addrbook_folderpath;
+	gchar *contact_sync_scope;
 	gboolean event_ask_add;
 	gboolean event_ask_delete;
 	gboolean event_ask_modify;
@@ -22,7 +22,13 @@
 
 /* This file has been stolen from the vformat plugin of OpenSync. */
 
+/* for memfd_create() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "vformat.h"
+#include "vformat_codec.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -33,6 +39,9 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <iconv.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 /**
  * STRING_IS_BASE64 is helper macro to check i a string is "b" or "base64"
@@ -62,57 +71,197 @@
 	( (check_string != NULL) && \
 	 !g_ascii_strcasecmp ((char *)check_string, "8bit") )
 
-static size_t base64_encode_step(unsigned char *in, size_t len, gboolean break_lines, unsigned char *out, int *state, int *save);
-static size_t base64_decode_step(unsigned char *in, size_t len, unsigned char *out, int *state, unsigned int *save);
 size_t base64_decode_simple (char *data, size_t len);
 char  *base64_encode_simple (const char *data, size_t len);
 
 size_t quoted_decode_simple (char *data, size_t len);
 char *quoted_encode_simple (const unsigned char *string, int len);
 
+#define PTR_ARRAY_LEN(array) ((array) ? (array)->len : 0)
 
-time_t vformat_time_to_unix(const char *inptime)
+/* drop a cached GList view, it is rebuilt by the next list accessor call */
+static void _drop_view (GList **view)
+{
+	g_list_free (*view);
+	*view = NULL;
+}
+
+static GList *_array_view (GPtrArray *array, GList **view)
 {
-	char *date = NULL;
-	char *time = NULL;
-	char *ftime = NULL;
-	if ((ftime = g_strrstr(inptime, "T"))) {
+	guint i;
 
-		date = g_strndup(inptime, ftime - inptime);
-		if (ftime[3] == ':')
-			time = g_strndup(ftime + 1, 8);
-		else
-			time = g_strndup(ftime + 1, 6);
-	} else {
-		date = g_strdup(inptime);
+	if (!*view && array) {
+		for (i = array->len; i > 0; i--)
+			*view = g_list_prepend (*view, g_ptr_array_index (array, i - 1));
+	}
+
+	return *view;
+}
+
+static void _array_append (GPtrArray **array, gpointer data, GList **view)
+{
+	if (!*array)
+		*array = g_ptr_array_new ();
+	g_ptr_array_add (*array, data);
+	_drop_view (view);
+}
+
+
+/* days since 1970-01-01 of a proleptic Gregorian date, @m is 1-based */
+static gint64 _days_from_civil (gint64 y, guint m, guint d)
+{
+	gint64 era;
+	guint yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (guint) (y - era * 400);
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (gint64) doe - 719468;
+}
+
+/* reads @n digits at *@p into @val, advancing *@p */
+static gboolean _read_digits (const char **p, guint n, guint *val)
+{
+	guint v = 0;
+
+	for (; n > 0; n--, (*p)++) {
+		if (**p < '0' || **p > '9')
+			return FALSE;
+		v = v * 10 + (**p - '0');
 	}
+	*val = v;
+	return TRUE;
+}
+
+/* The local UTC offset only changes on DST transitions, which happen on
+   the full hour, so it is looked up once per local hour and kept in a
+   small direct mapped table.  This saves a mktime() -- and with it a
+   look at the timezone database -- per converted time. */
+#define LOCAL_OFFSET_CACHE_SIZE 256
+
+typedef struct {
+	gint64 hour;
+	glong offset;
+} LocalOffset;
+
+static LocalOffset local_offsets[LOCAL_OFFSET_CACHE_SIZE];
+static gboolean local_offsets_valid[LOCAL_OFFSET_CACHE_SIZE];
+G_LOCK_DEFINE_STATIC (local_offsets);
 
+/* offset to subtract from @local, seconds since the epoch as if the
+   local wall clock time were UTC, to get the real time */
+static glong _local_offset (gint64 local)
+{
+	gint64 hour = (local >= 0 ? local : local - 3599) / 3600;
+	guint slot = (guint) hour % LOCAL_OFFSET_CACHE_SIZE;
+	gint64 days, secs;
 	struct tm btime;
-	memset(&btime, 0, sizeof(struct tm));
+	time_t utime;
+	glong offset;
+
+	G_LOCK (local_offsets);
+	if (local_offsets_valid[slot] && local_offsets[slot].hour == hour) {
+		offset = local_offsets[slot].offset;
+		G_UNLOCK (local_offsets);
+		return offset;
+	}
+	G_UNLOCK (local_offsets);
+
+	days = (hour >= 0 ? hour : hour - 23) / 24;
+	secs = hour * 3600 - days * 86400;
+
+	/* civil date back from the day count, the inverse of
+	   _days_from_civil() */
+	{
+		gint64 z = days + 719468;
+		gint64 era = (z >= 0 ? z : z - 146096) / 146097;
+		guint doe = (guint) (z - era * 146097);
+		guint yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		guint doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		guint mp = (5 * doy + 2) / 153;
+
+		memset (&btime, 0, sizeof (struct tm));
+		btime.tm_mday = doy - (153 * mp + 2) / 5 + 1;
+		btime.tm_mon = mp < 10 ? mp + 2 : mp - 10;
+		btime.tm_year = (int) (yoe + era * 400 + (btime.tm_mon < 2)) - 1900;
+		btime.tm_hour = (int) (secs / 3600);
+		btime.tm_isdst = -1;
+	}
 
-	if (strlen(date) == 10) {
-		btime.tm_year = date[0] * 1000 + date[1] * 100 + date[2] * 10 + date[3] - '0' * 1111 - 1900;
-		btime.tm_mon = date[5] * 10 + date[6] - '0' * 11 - 1;
-		btime.tm_mday = date[8] * 10 + date[9] - '0' * 11;
-	} else {
-		btime.tm_year = date[0] * 1000 + date[1] * 100 + date[2] * 10 + date[3] - '0' * 1111- 1900;
-		btime.tm_mon = date[4] * 10 + date[5] - '0' * 11 - 1;
-		btime.tm_mday = date[6] * 10 + date[7] - '0' * 11;
+	utime = mktime (&btime);
+	if (utime == (time_t) -1)
+		return 0;
+	offset = (glong) (hour * 3600 - (gint64) utime);
+
+	G_LOCK (local_offsets);
+	local_offsets[slot].hour = hour;
+	local_offsets[slot].offset = offset;
+	local_offsets_valid[slot] = TRUE;
+	G_UNLOCK (local_offsets);
+
+	return offset;
+}
+
+/* Converts an ISO 8601 date or date-time, basic (20070315T143000) or
+   extended (2007-03-15T14:30:00) form, to seconds since the epoch.
+   Fractional seconds are ignored.  A trailing 'Z' or a +hh[:]mm offset
+   gives an absolute time, otherwise the time is taken as local time.
+   Returns (time_t) -1 if @inptime can not be parsed. */
+time_t vformat_time_to_unix(const char *inptime)
+{
+	const char *p = inptime;
+	guint year, mon, day, hour = 0, min = 0, sec = 0;
+	gboolean extended;
+	gint64 t;
+
+	if (!p || !_read_digits (&p, 4, &year))
+		return (time_t) -1;
+	extended = (*p == '-');
+	if (extended)
+		p++;
+	if (!_read_digits (&p, 2, &mon) || (extended && *p++ != '-') ||
+	    !_read_digits (&p, 2, &day))
+		return (time_t) -1;
+	if (mon < 1 || mon > 12 || day < 1 || day > 31)
+		return (time_t) -1;
+
+	if (*p == 'T' || *p == 't') {
+		p++;
+		extended = (p[0] && p[1] && p[2] == ':');
+		if (!_read_digits (&p, 2, &hour) || (extended && *p++ != ':') ||
+		    !_read_digits (&p, 2, &min) || (extended && *p++ != ':') ||
+		    !_read_digits (&p, 2, &sec))
+			return (time_t) -1;
+		if (*p == '.' || *p == ',') {
+			p++;
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
 	}
 
-	if (time && strlen(time) == 8) {
-		//Time
-		btime.tm_hour = time[0] * 10 + time[1] - '0' * 11;
-		btime.tm_min = time[3] * 10 + time[4] - '0' * 11;
-		btime.tm_sec = time[6] * 10 + time[7] - '0' * 11;
-	} else if (time && strlen(time) == 6) {
-		btime.tm_hour = time[0] * 10 + time[1] - '0' * 11;
-		btime.tm_min = time[2] * 10 + time[3] - '0' * 11;
-		btime.tm_sec = time[4] * 10 + time[5] - '0' * 11;
+	t = _days_from_civil (year, mon, day) * 86400 + hour * 3600 + min * 60 + sec;
+
+	if (*p == 'Z' || *p == 'z')
+		return (time_t) t;
+
+	if (*p == '+' || *p == '-') {
+		guint oh, om = 0;
+		gint sign = (*p == '-') ? -1 : 1;
+
+		p++;
+		if (!_read_digits (&p, 2, &oh))
+			return (time_t) -1;
+		if (*p == ':')
+			p++;
+		if (*p)
+			_read_digits (&p, 2, &om);
+		return (time_t) (t - sign * (gint64) (oh * 3600 + om * 60));
 	}
 
-	time_t utime = mktime(&btime);
-	return utime;
+	return (time_t) (t - _local_offset (t));
 }
 
 static char *_fold_lines (char *buf)
@@ -312,91 +461,291 @@ static void _read_attribute_value_add (VFormatAttribute *attr, GString *str, GSt
 
 }
 
+/* Large values.  A base64 value of at least blob_threshold characters
+ * is decoded chunk by chunk into a memfd, or an unlinked temporary
+ * file, and only a read-only mapping of the bytes is kept.  The base64
+ * text is made again only if one of the raw value accessors asks for
+ * it. */
+
+#define BLOB_CHUNK 16384  /* base64 characters decoded at a time */
+
+struct VFormatBlob {
+	gint ref_count;
+	guchar *data;
+	gsize len;
+};
+
+static gsize blob_threshold = 64 * 1024;
+
+void
+vformat_set_blob_threshold (gsize threshold)
+{
+	blob_threshold = threshold;
+}
+
+gsize
+vformat_get_blob_threshold (void)
+{
+	return blob_threshold;
+}
+
+static VFormatBlob *
+_blob_ref (VFormatBlob *blob)
+{
+	g_atomic_int_inc (&blob->ref_count);
+	return blob;
+}
+
+static void
+_blob_unref (VFormatBlob *blob)
+{
+	if (!g_atomic_int_dec_and_test (&blob->ref_count))
+		return;
+
+	munmap (blob->data, blob->len);
+	g_free (blob);
+}
+
+static int
+_blob_open_fd (void)
+{
+	char *name;
+	int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create ("vformat-blob", MFD_CLOEXEC);
+	if (fd >= 0)
+		return fd;
+#endif
+	fd = g_file_open_tmp ("vformat-blob-XXXXXX", &name, NULL);
+	if (fd >= 0) {
+		unlink (name);
+		g_free (name);
+	}
+	return fd;
+}
+
+static gboolean
+_blob_write (int fd, const guchar *buf, gsize len)
+{
+	while (len > 0) {
+		ssize_t n = write (fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		buf += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+static gboolean
+_is_base64_char (char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+		(c >= '0' && c <= '9') || c == '+' || c == '/' || c == '=';
+}
+
+/* decodes the base64 text [@p, @end) into a new blob, NULL if no
+   backing file could be set up */
+static VFormatBlob *
+_blob_new_from_base64 (const char *p, const char *end)
+{
+	char in[BLOB_CHUNK];
+	guchar out[BLOB_CHUNK / 4 * 3 + 3];
+	VFormatBlob *blob;
+	gsize n_in = 0, len = 0;
+	gboolean ok = TRUE;
+	void *data;
+	int fd;
+
+	fd = _blob_open_fd ();
+	if (fd < 0)
+		return NULL;
+
+	/* only whole quantums are decoded before the end, so the chunks
+	   line up with the encoding */
+	for (; p < end && ok; p++) {
+		if (!_is_base64_char (*p))
+			continue;
+		in[n_in++] = *p;
+		if (n_in == BLOB_CHUNK) {
+			gsize n_out = vformat_base64_decode (in, n_in, out);
+			ok = _blob_write (fd, out, n_out);
+			len += n_out;
+			n_in = 0;
+		}
+	}
+	if (ok && n_in) {
+		gsize n_out = vformat_base64_decode (in, n_in, out);
+		ok = _blob_write (fd, out, n_out);
+		len += n_out;
+	}
+
+	if (!ok || !len) {
+		close (fd);
+		return NULL;
+	}
+
+	data = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	blob = g_new0 (VFormatBlob, 1);
+	blob->ref_count = 1;
+	blob->data = data;
+	blob->len = len;
+
+	return blob;
+}
+
+/* base64 encodes @blob onto @str, folding the lines at 75 characters.
+   @col is the number of characters already on the current line. */
+static void
+_blob_append_folded (GString *str, const VFormatBlob *blob, gsize col)
+{
+	char buf[BLOB_CHUNK];
+	gsize done = 0;
+
+	while (done < blob->len) {
+		gsize n = MIN (blob->len - done, BLOB_CHUNK / 4 * 3);
+		gsize n_out = vformat_base64_encode (blob->data + done, n, buf);
+		const char *q = buf;
+
+		done += n;
+		while (n_out > 0) {
+			gsize run;
+
+			if (col >= 75) {
+				str = g_string_append_len (str, CRLF " ", sizeof (CRLF " ") - 1);
+				col = 1;
+			}
+			run = MIN (n_out, 75 - col);
+			str = g_string_append_len (str, q, run);
+			q += run;
+			n_out -= run;
+			col += run;
+		}
+	}
+}
+
+/* reads a base64 value into a blob if it is large enough.  FALSE if it
+   is not, or if no blob could be made; it is read as usual then. */
+static gboolean
+_read_attribute_blob (VFormatAttribute *attr, char **p)
+{
+	char *lp = *p;
+	char *end = lp + strcspn (lp, "\r");
+	VFormatBlob *blob;
+
+	if (!blob_threshold || (gsize) (end - lp) < blob_threshold)
+		return FALSE;
+
+	blob = _blob_new_from_base64 (lp, end);
+	if (!blob)
+		return FALSE;
+
+	attr->body->blob = blob;
+	/* the text is made on demand, see _attribute_blob_text() */
+	_array_append (&attr->body->values, NULL, &attr->value_list);
+
+	lp = end;
+	if (*lp == '\r') {
+		lp++;
+		if (*lp == '\n')
+			lp++;
+	}
+	*p = lp;
+
+	return TRUE;
+}
+
+/* fills in the base64 text of a blob value for the raw accessors */
+static void
+_attribute_blob_text (VFormatAttribute *attr)
+{
+	VFormatAttributeBody *body = attr->body;
+	char *text;
+
+	if (!body->blob || g_ptr_array_index (body->values, 0))
+		return;
+
+	text = g_malloc (VFORMAT_BASE64_ENCODED_LEN (body->blob->len) + 1);
+	text[vformat_base64_encode (body->blob->data, body->blob->len, text)] = '\0';
+	g_ptr_array_index (body->values, 0) = text;
+	_drop_view (&attr->value_list);
+}
+
+/* turns a blob value into a plain one before the values change */
+static void
+_attribute_drop_blob (VFormatAttribute *attr)
+{
+	if (!attr->body->blob)
+		return;
+
+	_attribute_blob_text (attr);
+	_blob_unref (attr->body->blob);
+	attr->body->blob = NULL;
+}
+
+const guchar *
+vformat_attribute_get_blob (VFormatAttribute *attr, gsize *len)
+{
+	g_return_val_if_fail (attr != NULL, NULL);
+
+	if (!attr->body->blob)
+		return NULL;
+
+	if (len)
+		*len = attr->body->blob->len;
+	return attr->body->blob->data;
+}
+
+/* the characters _read_attribute_value() does not simply copy */
+static const char value_specials[] = "=\\;,";
+/* the ones that end a quoted-printable run */
+static const char qp_value_specials[] = "\\;,";
+
 static void _read_attribute_value (VFormatAttribute *attr, char **p, int format_encoding, GString *charset)
 {
 	char *lp = *p;
+	char *value_end = lp; /* the next '\r' or the end, found when needed */
 	GString *str;
 	GString *str_nocr;
 
+	if (format_encoding == VF_ENCODING_BASE64 && _read_attribute_blob (attr, p))
+		return;
+
 	/* read in the value */
 	str = g_string_new ("");
 	while (*lp != '\r' && *lp != '\0') {
-		if (*lp == '=' && format_encoding == VF_ENCODING_QP) {
-			char a, b, x1=0, x2=0;
-
-			if ((a = *(++lp)) == '\0') break;
-			if ((b = *(++lp)) == '\0') break;
-
-			if (isalnum(a)) {
-				if (isalnum(b)) {
-					/* e.g. ...N=C3=BCrnberg\r\n
-					 *          ^^^
-			       		 */
-					x1=a;
-					x2=b;
-				}
-				else if (b == '=') {
-					/* e.g. ...N=C=\r\n
-					 *          ^^^
-					 * 3=BCrnberg...
-					 * ^
-					 */
-					char *tmplp = lp;
-					if (*(++tmplp) == '\r' && *(++tmplp) == '\n' && isalnum(*(++tmplp))) {
-						x1 = a;
-						x2 = *tmplp;
-						lp = tmplp;
-					}
-				}
-				else {
-					/* append malformed input, and
-				   	   continue parsing */
-					str = g_string_append_c(str, a);
-					str = g_string_append_c(str, b);
-				}
-			}
-			else if (a == '=') {
-				char *tmplp = lp;
-				char c, d, e;
-				c = *(++tmplp);
-				d = *(++tmplp);
-				e = *(++tmplp);
-				if (b == '\r' && c == '\n' && isalnum(d) && isalnum(e)) {
-					x1 = d;
-					x2 = e;
-					lp = tmplp;
-				}
-				else {
-					/* append malformed input, and
-				   	   continue parsing */
-					str = g_string_append_c(str, a);
-					str = g_string_append_c(str, b);
-				}
-			}
-			else {
-				/* append malformed input, and
-				   continue parsing */
-				str = g_string_append_c(str, a);
-				str = g_string_append_c(str, b);
-			}
-			if (x1 && x2) {
-				char c;
-
-				a = tolower (x1);
-				b = tolower (x2);
-
-				c = (((a>='a'?a-'a'+10:a-'0')&0x0f) << 4)
-					| ((b>='a'?b-'a'+10:b-'0')&0x0f);
-
-				str = g_string_append_c (str, c);
-			}
-			lp++;
-			x1 = x2 = 0;
+		if (format_encoding == VF_ENCODING_QP &&
+		    *lp != '\\' && *lp != ';' && *lp != ',') {
+			/* decode up to the next character that needs a closer
+			   look in one go.  This is done in place, the buffer
+			   is not read again.  Soft line breaks were removed by
+			   _fold_lines() already. */
+			gsize run, len;
+			if (value_end <= lp)
+				value_end = lp + strcspn (lp, "\r");
+			run = vformat_scan_until (lp, value_end - lp, qp_value_specials, sizeof (qp_value_specials) - 1);
+			len = vformat_qp_decode (lp, run, (guchar *) lp);
+			str = g_string_append_len (str, lp, len);
+			lp += run;
 		}
 		else if (format_encoding == VF_ENCODING_BASE64) {
-			if((*lp != ' ') && (*lp != '\t') )
-				str = g_string_append_unichar (str, g_utf8_get_char (lp));
-			lp = g_utf8_next_char(lp);
+			/* copy up to the next blank, which is dropped */
+			gsize run;
+			if (value_end <= lp)
+				value_end = lp + strcspn (lp, "\r");
+			run = vformat_scan_until (lp, value_end - lp, " \t", 2);
+			str = g_string_append_len (str, lp, run);
+			lp += run;
+			while (*lp == ' ' || *lp == '\t')
+				lp++;
 		}
 		else if (*lp == '\\') {
 			/* convert back to the non-escaped version of
@@ -411,7 +760,7 @@ static void _read_attribute_value (VFormatAttribute *attr, char **p, int format_
 				case 'r': str = g_string_append_c (str, '\r'); break;
 				case ';': str = g_string_append_c (str, ';'); break;
 				case ',':
-					if (!g_ascii_strcasecmp(attr->name, "CATEGORIES")) {
+					if (attr->name_atom == VF_ATOM_CATEGORIES) {
 						//We need to handle categories here to work
 						//aroung a bug in evo2
 						_read_attribute_value_add (attr, str, charset);
@@ -437,32 +786,41 @@ static void _read_attribute_value (VFormatAttribute *attr, char **p, int format_
 			lp = g_utf8_next_char(lp);
 		}
 		else if ((*lp == ';') ||
-			 (*lp == ',' && !g_ascii_strcasecmp(attr->name, "CATEGORIES"))) {
+			 (*lp == ',' && attr->name_atom == VF_ATOM_CATEGORIES)) {
 			_read_attribute_value_add (attr, str, charset);
 			g_string_assign (str, "");
 			lp = g_utf8_next_char(lp);
 		}
 		else {
-			str = g_string_append_unichar (str, g_utf8_get_char (lp));
-			lp = g_utf8_next_char(lp);
+			/* copy everything up to the next character that needs
+			   a closer look in one go */
+			gsize run;
+			if (value_end <= lp)
+				value_end = lp + strcspn (lp, "\r");
+			run = vformat_scan_until (lp, value_end - lp, value_specials, sizeof (value_specials) - 1);
+			if (!run)
+				run = g_utf8_next_char (lp) - lp;
+			str = g_string_append_len (str, lp, run);
+			lp += run;
 		}
 	}
 
 	if (str) {
 		// remove CR from the value
-		char *tmpp;
-		str_nocr = g_string_new("");
-		for (tmpp = str->str; tmpp && *tmpp; tmpp++) {
-			switch (*tmpp) {
-			case '\r':
-				if (*(tmpp+1) == '\n')
-					tmpp++;
-				str_nocr = g_string_append (str_nocr, "\n");
-				break;
-			default:
-				str_nocr = g_string_append_c (str_nocr, *tmpp);
+		const char *tmpp = str->str;
+		const char *end = str->str + str->len;
+		str_nocr = g_string_sized_new (str->len);
+		while (tmpp < end) {
+			const char *cr = memchr (tmpp, '\r', end - tmpp);
+			if (!cr) {
+				str_nocr = g_string_append_len (str_nocr, tmpp, end - tmpp);
 				break;
 			}
+			str_nocr = g_string_append_len (str_nocr, tmpp, cr - tmpp);
+			str_nocr = g_string_append_c (str_nocr, '\n');
+			tmpp = cr + 1;
+			if (tmpp < end && *tmpp == '\n')
+				tmpp++;
 		}
 
 		_read_attribute_value_add (attr, str_nocr, charset);
@@ -503,6 +861,9 @@ static void _read_attribute_params(VFormatAttribute *attr, char **p, int *format
 		 */
 		else if (*lp == '=') {
 			if (str->len > 0) {
+				/* a naked value list cut short by a new name */
+				if (param)
+					vformat_attribute_param_free (param);
 				param = vformat_attribute_param_new (str->str);
 				g_string_assign (str, "");
 				lp = g_utf8_next_char (lp);
@@ -538,7 +899,7 @@ static void _read_attribute_params(VFormatAttribute *attr, char **p, int *format
 					 * (unless it's the ':'). If there aren't values, we free
 					 * the parameter then skip past the character.
 					 */
-					if (!param->values) {
+					if (!vformat_attribute_param_get_n_values (param)) {
 						vformat_attribute_param_free (param);
 						param = NULL;
 						if (!colon)
@@ -546,15 +907,17 @@ static void _read_attribute_params(VFormatAttribute *attr, char **p, int *format
 					}
 				}
 
-				if (param
-				    && !g_ascii_strcasecmp (param->name, "encoding")) {
-					if (STRING_IS_QP(param->values->data)) {
+				if (param && param->name_atom == VF_ATOM_ENCODING) {
+					const char *encoding = vformat_attribute_param_get_nth_value (param, 0);
+					if (STRING_IS_QP(encoding)) {
 						*format_encoding = VF_ENCODING_QP;
-					} else if ( STRING_IS_BASE64(param->values->data)) {
+					} else if ( STRING_IS_BASE64(encoding)) {
 						*format_encoding = VF_ENCODING_BASE64;
 					}
-				} else if (param && !g_ascii_strcasecmp(param->name, "charset")) {
-					*charset = g_string_new(param->values->data);
+				} else if (param && param->name_atom == VF_ATOM_CHARSET) {
+					if (*charset)
+						g_string_free (*charset, TRUE);
+					*charset = g_string_new(vformat_attribute_param_get_nth_value (param, 0));
 				}
 			}
 			else {
@@ -601,8 +964,10 @@ static void _read_attribute_params(VFormatAttribute *attr, char **p, int *format
 				}
 			}
 			if (param && !comma) {
-				if(g_ascii_strcasecmp (param->name, "encoding"))  // value are already decoded in _read_attribute_value. Setting encoding
+				if(param->name_atom != VF_ATOM_ENCODING)  // value are already decoded in _read_attribute_value. Setting encoding
 	  				vformat_attribute_add_param (attr, param);// would lead to double decoding of the value.
+				else
+					vformat_attribute_param_free (param);
 				param = NULL;
 			}
 			if (colon)
@@ -611,9 +976,15 @@ static void _read_attribute_params(VFormatAttribute *attr, char **p, int *format
 		else {
 			g_string_assign (str, "");
 			_skip_until (&lp, ":;");
+			/* no ':' on this line, _skip_until() won't move past the CR */
+			if (*lp == '\r')
+				break;
 		}
 	}
 
+	/* a parameter still waiting for its value on a broken line */
+	if (param)
+		vformat_attribute_param_free (param);
 	if (str)
 		g_string_free (str, TRUE);
 
@@ -679,6 +1050,7 @@ static VFormatAttribute *_read_attribute (char **p)
 	}
 
 	if (!attr_name) {
+		g_string_free (str, TRUE);
 		_skip_to_next_line (p);
 		goto lose;
 	}
@@ -701,7 +1073,11 @@ static VFormatAttribute *_read_attribute (char **p)
 	if (charset) g_string_free(charset, TRUE);
 	*p = lp;
 
-	if (!attr->values)
+	/* the ENCODING param itself is consumed by the value parser */
+	if (is_qp != VF_ENCODING_RAW)
+		attr->body->type_mask |= VF_PARAM_ENCODING;
+
+	if (!vformat_attribute_get_n_values (attr))
 		goto lose;
 
 	return attr;
@@ -711,6 +1087,31 @@ static VFormatAttribute *_read_attribute (char **p)
 	return NULL;
 }
 
+/* reads all attributes of the unfolded @buf into @evc.  While *@first
+ * is set, the first attribute read is dropped if it is the BEGIN line,
+ * and *@first is cleared. */
+static void _parse_unfolded (VFormat *evc, char *buf, gboolean *first)
+{
+	char *p = buf;
+
+	while (*p) {
+		VFormatAttribute *attr = _read_attribute (&p);
+
+		if (!attr)
+			continue;
+
+		if (*first) {
+			*first = FALSE;
+			if (attr->name_atom == VF_ATOM_BEGIN) {
+				vformat_attribute_free (attr);
+				continue;
+			}
+		}
+		//if (attr->name_atom != VF_ATOM_END)
+			vformat_add_attribute (evc, attr);
+	}
+}
+
 /* we try to be as forgiving as we possibly can here - this isn't a
  * validator.  Almost nothing is considered a fatal error.  We always
  * try to return *something*.
@@ -718,8 +1119,8 @@ static VFormatAttribute *_read_attribute (char **p)
 static void _parse(VFormat *evc, const char *str)
 {
 	char *buf = g_strdup (str);
-	char *p, *end;
-	VFormatAttribute *attr;
+	char *end;
+	gboolean first = TRUE;
 
 	/* first validate the string is valid utf8 */
 	if (!g_utf8_validate (buf, -1, (const char **)&end)) {
@@ -729,143 +1130,505 @@ static void _parse(VFormat *evc, const char *str)
 
 	buf = _fold_lines (buf);
 
-	p = buf;
+	_parse_unfolded (evc, buf, &first);
+
+	g_free (buf);
+}
+
+struct VFormatParser {
+	VFormat  *format;
+	GString  *line;    /* the current logical line, still folded */
+	GString  *partial; /* a physical line whose newline has not arrived yet */
+	gboolean  qp;      /* the current logical line is quoted-printable */
+	gboolean  first;   /* no attribute has been read yet */
+	gboolean  broken;  /* invalid utf8 was seen, ignore the rest */
+};
 
-	attr = _read_attribute (&p);
-	if (!attr)
-		attr = _read_attribute (&p);
+/* case insensitive search for @needle in the first @len bytes of @s */
+static gboolean _contains_nocase (const char *s, gsize len, const char *needle)
+{
+	gsize n = strlen (needle);
+	gsize i;
 
-	if (!attr || attr->group || g_ascii_strcasecmp (attr->name, "begin")) {
+	for (i = 0; i + n <= len; i++) {
+		if (!g_ascii_strncasecmp (s + i, needle, n))
+			return TRUE;
 	}
-	if (attr && !g_ascii_strcasecmp (attr->name, "begin"))
-		vformat_attribute_free (attr);
-	else if (attr)
-		vformat_add_attribute (evc, attr);
+	return FALSE;
+}
 
-	while (*p) {
-		VFormatAttribute *next_attr = _read_attribute (&p);
+/* TRUE if @line ends in a quoted-printable soft line break */
+static gboolean _ends_with_soft_break (GString *line)
+{
+	gsize len = line->len;
 
-		if (next_attr) {
-			//if (g_ascii_strcasecmp (next_attr->name, "end"))
-				vformat_add_attribute (evc, next_attr);
-			attr = next_attr;
-		}
+	while (len && (line->str[len - 1] == '\n' || line->str[len - 1] == '\r'))
+		len--;
+
+	return len && line->str[len - 1] == '=';
+}
+
+static void _parser_flush_line (VFormatParser *parser)
+{
+	char *buf, *end;
+
+	if (!parser->line->len)
+		return;
+
+	buf = g_string_free (parser->line, FALSE);
+	parser->line = g_string_new ("");
+
+	if (parser->broken) {
+		g_free (buf);
+		return;
 	}
 
-	if (!attr || attr->group || g_ascii_strcasecmp (attr->name, "end")) {
-	  ;
+	/* same as _parse(): stop at the first invalid utf8 sequence */
+	if (!g_utf8_validate (buf, -1, (const char **)&end)) {
+		*end = '\0';
+		parser->broken = TRUE;
 	}
 
+	buf = _fold_lines (buf);
+	_parse_unfolded (parser->format, buf, &parser->first);
 	g_free (buf);
 }
 
-char *vformat_escape_string (const char *s, VFormatType type)
+/* a physical line including its newline, if any.  Continuation lines
+   are collected until the logical line is complete, which is only
+   known once the next line starts. */
+static void _parser_add_line (VFormatParser *parser, const char *line, gsize len)
 {
-	GString *str;
-	const char *p;
+	gboolean continued = FALSE;
 
-	str = g_string_new ("");
+	if (parser->line->len) {
+		if (line[0] == ' ' || line[0] == '\t')
+			continued = TRUE;
+		else if (parser->qp && _ends_with_soft_break (parser->line))
+			continued = TRUE;
+	}
 
-	/* Escape a string as described in RFC2426, section 5 */
-	for (p = s; p && *p; p++) {
-		switch (*p) {
-		case '\n':
-			/** 
-			 * We won't escape newlines
-			 * on vcard 2.1, unless it is in the end of a value.
-			 * See comments above for a better explanation
-			**/
-			if (*p != '\0' && type == VFORMAT_CARD_21) {
-				str = g_string_append (str, "\r\n");
-			}
-			else {
-				str = g_string_append (str, "\\n");
-			}
-			break;
-		case '\r':
-			if (*(p+1) == '\n')
-				p++;
-			/** 
-			 * We won't escape carriage returns
-			 * on vcard 2.1, unless it is in the end of a value.
-			 * See comments above for a better explanation
-			**/
-			if (*p != '\0' && type == VFORMAT_CARD_21) {
-				str = g_string_append (str, "\r\n");
-			}
-			else {
-				str = g_string_append (str, "\\n");
-			}
-			break;
-		case ';':
-			str = g_string_append (str, "\\;");
-			break;
-		case ',':
-			if (type == VFORMAT_CARD_30 || type == VFORMAT_EVENT_20 || type == VFORMAT_TODO_20)
-				str = g_string_append (str, "\\,");
-			else
-				str = g_string_append_c (str, *p);
-			break;
-		case '\\':
-			/** 
-			 * We won't escape backslashes
-			 * on vcard 2.1, unless it is in the end of a value.
-			 * See comments above for a better explanation
-			**/
-			if (*p != '\0' && type == VFORMAT_CARD_21) {
-				str = g_string_append_c(str, *p);
-			}
-			else {
-				str = g_string_append (str, "\\\\");
-			}
-			break;
-		default:
-			str = g_string_append_c (str, *p);
-			break;
-		}
+	if (!continued) {
+		_parser_flush_line (parser);
+		parser->qp = _contains_nocase (line, len, "ENCODING=QUOTED-PRINTABLE");
 	}
 
-	return g_string_free (str, FALSE);
+	g_string_append_len (parser->line, line, len);
 }
 
-char*
-vformat_unescape_string (const char *s)
+VFormatParser *vformat_parser_new (void)
 {
-	GString *str;
-	const char *p;
+	VFormatParser *parser = g_new0 (VFormatParser, 1);
 
-	g_return_val_if_fail (s != NULL, NULL);
+	parser->format = vformat_new ();
+	parser->line = g_string_new ("");
+	parser->partial = g_string_new ("");
+	parser->first = TRUE;
 
-	str = g_string_new ("");
+	return parser;
+}
 
-	/* Unescape a string as described in RFC2426, section 4 (Formal Grammar) */
-	for (p = s; *p; p++) {
-		if (*p == '\\') {
-			p++;
-			if (*p == '\0') {
-				str = g_string_append_c (str, '\\');
-				break;
-			}
-			switch (*p) {
-			case 'n':  str = g_string_append_c (str, '\n'); break;
-			case 'r':  str = g_string_append_c (str, '\r'); break;
-			case ';':  str = g_string_append_c (str, ';'); break;
-			case ',':  str = g_string_append_c (str, ','); break;
-			case '\\': str = g_string_append_c (str, '\\'); break;
-			case '"': str = g_string_append_c (str, '"'); break;
-			  /* \t is (incorrectly) used by kOrganizer, so handle it here */
-			case 't': str = g_string_append_c (str, '\t'); break;
-			default:
-				str = g_string_append_c (str, '\\');
-				str = g_string_append_unichar (str, g_utf8_get_char(p));
+void vformat_parser_feed (VFormatParser *parser, const char *bytes, gsize len)
+{
+	const char *nl;
+	gsize n;
+
+	g_return_if_fail (parser != NULL);
+	g_return_if_fail (bytes != NULL || len == 0);
+
+	while (len) {
+		nl = memchr (bytes, '\n', len);
+		if (!nl) {
+			g_string_append_len (parser->partial, bytes, len);
+			return;
+		}
+		n = nl - bytes + 1;
+
+		if (parser->partial->len) {
+			g_string_append_len (parser->partial, bytes, n);
+			_parser_add_line (parser, parser->partial->str, parser->partial->len);
+			g_string_truncate (parser->partial, 0);
+		}
+		else
+			_parser_add_line (parser, bytes, n);
+
+		bytes += n;
+		len -= n;
+	}
+}
+
+VFormat *vformat_parser_finish (VFormatParser *parser)
+{
+	VFormat *format;
+
+	g_return_val_if_fail (parser != NULL, NULL);
+
+	if (parser->partial->len)
+		_parser_add_line (parser, parser->partial->str, parser->partial->len);
+	_parser_flush_line (parser);
+
+	format = parser->format;
+	parser->format = NULL;
+	vformat_parser_free (parser);
+
+	return format;
+}
+
+void vformat_parser_free (VFormatParser *parser)
+{
+	g_return_if_fail (parser != NULL);
+
+	if (parser->format)
+		vformat_free (parser->format);
+	g_string_free (parser->line, TRUE);
+	g_string_free (parser->partial, TRUE);
+	g_free (parser);
+}
+
+/* TRUE if the physical line at @p starts with @keyword, a ':' follows */
+static gboolean _line_is (const char *p, const char *end, const char *keyword)
+{
+	gsize n = strlen (keyword);
+
+	return (gsize)(end - p) > n && p[n] == ':' && !g_ascii_strncasecmp (p, keyword, n);
+}
+
+/* finds the next top level BEGIN...END block in [@p, @end).  Returns
+   its end (the start of the line after END), *@start is set to its
+   BEGIN line.  NULL if there is no further object. */
+static const char *_next_object (const char *p, const char *end, const char **start)
+{
+	const char *next;
+	guint depth = 0;
+
+	for (; p < end; p = next) {
+		const char *nl = memchr (p, '\n', end - p);
+		next = nl ? nl + 1 : end;
+
+		if (_line_is (p, end, "BEGIN")) {
+			if (!depth)
+				*start = p;
+			depth++;
+		}
+		else if (depth && _line_is (p, end, "END")) {
+			if (!--depth)
+				return next;
+		}
+	}
+
+	/* be forgiving about a missing END at the end of the data */
+	return depth ? end : NULL;
+}
+
+typedef struct {
+	const char *start;
+	const char *end;
+	GPtrArray  *formats;
+} VFormatBulkChunk;
+
+static void _bulk_parse_chunk (gpointer data, gpointer user_data)
+{
+	VFormatBulkChunk *chunk = data;
+	const char *p = chunk->start;
+	const char *start, *obj_end;
+
+	while ((obj_end = _next_object (p, chunk->end, &start)) != NULL) {
+		char *str = g_strndup (start, obj_end - start);
+		g_ptr_array_add (chunk->formats, vformat_new_from_string (str));
+		g_free (str);
+		p = obj_end;
+	}
+}
+
+static guint _bulk_default_threads (void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf (_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return n;
+#endif
+	return 1;
+}
+
+GPtrArray *vformat_parse_bulk (const char *buf, gsize len, guint max_threads)
+{
+	const char *end = buf + len;
+	const char *p = buf;
+	const char *start, *obj_end;
+	GPtrArray *chunks, *result;
+	VFormatBulkChunk *chunk = NULL;
+	GThreadPool *pool = NULL;
+	gsize target;
+	guint i, j;
+
+	g_return_val_if_fail (buf != NULL || len == 0, NULL);
+
+	if (!max_threads)
+		max_threads = _bulk_default_threads ();
+
+	/* a few chunks per thread evens out differences in card size */
+	target = MAX (len / (max_threads * 4), 16 * 1024);
+
+	chunks = g_ptr_array_new ();
+	while ((obj_end = _next_object (p, end, &start)) != NULL) {
+		if (!chunk || (gsize)(obj_end - chunk->start) > target) {
+			chunk = g_new0 (VFormatBulkChunk, 1);
+			chunk->start = start;
+			chunk->formats = g_ptr_array_new ();
+			g_ptr_array_add (chunks, chunk);
+		}
+		chunk->end = obj_end;
+		p = obj_end;
+	}
+
+	if (chunks->len > 1 && max_threads > 1) {
+#if !GLIB_CHECK_VERSION(2,32,0)
+		if (!g_thread_supported ())
+			g_thread_init (NULL);
+#endif
+		pool = g_thread_pool_new (_bulk_parse_chunk, NULL,
+		                          MIN (max_threads, chunks->len), FALSE, NULL);
+	}
+
+	for (i = 0; i < chunks->len; i++) {
+		if (pool)
+			g_thread_pool_push (pool, g_ptr_array_index (chunks, i), NULL);
+		else
+			_bulk_parse_chunk (g_ptr_array_index (chunks, i), NULL);
+	}
+	if (pool)
+		g_thread_pool_free (pool, FALSE, TRUE);
+
+	/* the chunks are in input order, and so are the cards within */
+	result = g_ptr_array_new ();
+	for (i = 0; i < chunks->len; i++) {
+		chunk = g_ptr_array_index (chunks, i);
+		for (j = 0; j < chunk->formats->len; j++)
+			g_ptr_array_add (result, g_ptr_array_index (chunk->formats, j));
+		g_ptr_array_free (chunk->formats, TRUE);
+		g_free (chunk);
+	}
+	g_ptr_array_free (chunks, TRUE);
+
+	return result;
+}
+
+/* the characters vformat_escape_string() has to look at for @type */
+static const char *_escape_specials (VFormatType type, guint *n_specials)
+{
+	switch (type) {
+	case VFORMAT_CARD_21:
+		*n_specials = 3;
+		return "\n\r;";
+	case VFORMAT_CARD_30:
+	case VFORMAT_EVENT_20:
+	case VFORMAT_TODO_20:
+		*n_specials = 5;
+		return "\n\r;,\\";
+	default:
+		*n_specials = 4;
+		return "\n\r;\\";
+	}
+}
+
+/* where escaped output goes: appended to @str, or written to @buf as
+   long as it fits.  @len counts all output either way. */
+typedef struct {
+	GString *str;
+	char    *buf;
+	gsize    size;
+	gsize    len;
+} EscapeSink;
+
+static void _sink_put (EscapeSink *sink, const char *s, gsize n)
+{
+	if (sink->str)
+		g_string_append_len (sink->str, s, n);
+	else if (sink->len + n <= sink->size)
+		memcpy (sink->buf + sink->len, s, n);
+	sink->len += n;
+}
+
+/* Escape a string as described in RFC2426, section 5.  Runs without
+   special characters are passed on in one piece. */
+static void _escape (const char *s, gsize len, VFormatType type, EscapeSink *sink)
+{
+	const char *end = s + len;
+	const char *specials;
+	guint n_specials;
+
+	specials = _escape_specials (type, &n_specials);
+
+	while (s < end) {
+		gsize run = vformat_scan_until (s, end - s, specials, n_specials);
+
+		if (run) {
+			_sink_put (sink, s, run);
+			s += run;
+			if (s == end)
 				break;
-			}
 		}
+
+		switch (*s) {
+		case '\r':
+			if (s + 1 < end && s[1] == '\n')
+				s++;
+			/* fall through */
+		case '\n':
+			/**
+			 * We won't escape newlines and carriage returns
+			 * on vcard 2.1, unless it is in the end of a value.
+			 * See comments above for a better explanation
+			**/
+			if (type == VFORMAT_CARD_21)
+				_sink_put (sink, "\r\n", 2);
+			else
+				_sink_put (sink, "\\n", 2);
+			break;
+		case ';':
+			_sink_put (sink, "\\;", 2);
+			break;
+		case ',':
+			/* only special for vcard 3.0 and icalendar 2.0 */
+			_sink_put (sink, "\\,", 2);
+			break;
+		case '\\':
+			/* not escaped on vcard 2.1, which never gets here */
+			_sink_put (sink, "\\\\", 2);
+			break;
+		}
+		s++;
+	}
+}
+
+gboolean vformat_string_needs_escape (const char *s, gssize len, VFormatType type)
+{
+	const char *specials;
+	guint n_specials;
+
+	if (!s)
+		return FALSE;
+	if (len < 0)
+		len = strlen (s);
+
+	specials = _escape_specials (type, &n_specials);
+	return vformat_scan_until (s, len, specials, n_specials) < (gsize)len;
+}
+
+void vformat_escape_string_append (GString *str, const char *s, gssize len, VFormatType type)
+{
+	EscapeSink sink = { str, NULL, 0, 0 };
+
+	g_return_if_fail (str != NULL);
+
+	if (!s)
+		return;
+	if (len < 0)
+		len = strlen (s);
+
+	_escape (s, len, type, &sink);
+}
+
+gsize vformat_escape_string_to_buffer (const char *s, gssize len, VFormatType type,
+                                       char *buf, gsize buf_size)
+{
+	EscapeSink sink = { NULL, buf, buf_size, 0 };
+
+	if (s) {
+		if (len < 0)
+			len = strlen (s);
+		_escape (s, len, type, &sink);
 	}
+	if (sink.len < buf_size)
+		buf[sink.len] = '\0';
+
+	return sink.len;
+}
+
+char *vformat_escape_string (const char *s, VFormatType type)
+{
+	GString *str;
+	EscapeSink sink = { NULL, NULL, 0, 0 };
+	gsize len = s ? strlen (s) : 0;
+
+	/* most values need no escaping at all, and only grow a bit if
+	   they do */
+	str = g_string_sized_new (len + len / 8 + 1);
+	sink.str = str;
+	if (s)
+		_escape (s, len, type, &sink);
 
 	return g_string_free (str, FALSE);
 }
 
+gsize
+vformat_unescape_string_to_buffer (const char *s, gssize len, char *buf)
+{
+	const char *p = s;
+	const char *end;
+	char *o = buf;
+
+	g_return_val_if_fail (s != NULL, 0);
+
+	if (len < 0)
+		len = strlen (s);
+	end = s + len;
+
+	/* Unescape a string as described in RFC2426, section 4 (Formal Grammar) */
+	while (p < end) {
+		const char *bs = memchr (p, '\\', end - p);
+		gsize run = (bs ? bs : end) - p;
+
+		/* the output never gets ahead of the input */
+		if (o != p)
+			memmove (o, p, run);
+		o += run;
+		p += run;
+		if (!bs)
+			break;
+
+		p++;
+		if (p == end) {
+			*o++ = '\\';
+			break;
+		}
+		switch (*p) {
+		case 'n':  *o++ = '\n'; break;
+		case 'r':  *o++ = '\r'; break;
+		case ';':  *o++ = ';'; break;
+		case ',':  *o++ = ','; break;
+		case '\\': *o++ = '\\'; break;
+		case '"':  *o++ = '"'; break;
+		  /* \t is (incorrectly) used by kOrganizer, so handle it here */
+		case 't':  *o++ = '\t'; break;
+		default:
+			/* keep the backslash, the character itself is copied
+			   with the next run */
+			*o++ = '\\';
+			continue;
+		}
+		p++;
+	}
+	*o = '\0';
+
+	return o - buf;
+}
+
+char*
+vformat_unescape_string (const char *s)
+{
+	char *str;
+	gsize len;
+
+	g_return_val_if_fail (s != NULL, NULL);
+
+	len = strlen (s);
+	str = g_malloc (len + 1);
+	vformat_unescape_string_to_buffer (s, len, str);
+
+	return str;
+}
+
 void
 vformat_construct (VFormat *evc, const char *str)
 {
@@ -877,8 +1640,12 @@ vformat_construct (VFormat *evc, const char *str)
 
 void vformat_free(VFormat *format)
 {
-	g_list_foreach (format->attributes, (GFunc)vformat_attribute_free, NULL);
-	g_list_free (format->attributes);
+	if (format->attributes) {
+		g_ptr_array_foreach (format->attributes, (GFunc)vformat_attribute_free, NULL);
+		g_ptr_array_free (format->attributes, TRUE);
+	}
+	g_free (format->name_index);
+	g_list_free (format->attribute_list);
 	g_free(format);
 }
 
@@ -897,23 +1664,64 @@ VFormat *vformat_new(void)
 	return vformat_new_from_string ("");
 }
 
-VFormatAttribute *vformat_find_attribute(VFormat *vcard, const char *name)
+static guint _atom_hash (VFormatAtom atom)
+{
+	return atom * 2654435761U;
+}
+
+static void _name_index_insert (VFormat *evc, guint slot)
 {
-	GList *attributes = vformat_get_attributes(vcard);
-	GList *a = NULL;
-	for (a = attributes; a; a = a->next) {
-		VFormatAttribute *attr = a->data;
-		if (!strcmp(vformat_attribute_get_name(attr), name)) {
+	VFormatAttribute *attr = g_ptr_array_index (evc->attributes, slot);
+	guint mask = evc->name_index_size - 1;
+	guint i = _atom_hash (attr->name_atom) & mask;
+
+	/* linear probing keeps attributes of the same name in card order */
+	while (evc->name_index[i])
+		i = (i + 1) & mask;
+	evc->name_index[i] = slot + 1;
+}
+
+static void _name_index_rebuild (VFormat *evc, guint size)
+{
+	guint slot;
+
+	g_free (evc->name_index);
+	evc->name_index = g_new0 (guint, size);
+	evc->name_index_size = size;
+
+	for (slot = 0; slot < PTR_ARRAY_LEN (evc->attributes); slot++)
+		_name_index_insert (evc, slot);
+}
+
+VFormatAttribute *vformat_find_attribute_atom(VFormat *vcard, VFormatAtom atom)
+{
+	guint mask, i, slot;
+
+	g_return_val_if_fail (vcard != NULL, NULL);
+
+	if (!vcard->name_index || atom == VF_ATOM_UNKNOWN)
+		return NULL;
+
+	mask = vcard->name_index_size - 1;
+	for (i = _atom_hash (atom) & mask; (slot = vcard->name_index[i]); i = (i + 1) & mask) {
+		VFormatAttribute *attr = g_ptr_array_index (vcard->attributes, slot - 1);
+		if (attr->name_atom == atom)
 			return attr;
-		}
 	}
 	return NULL;
 }
 
+VFormatAttribute *vformat_find_attribute(VFormat *vcard, const char *name)
+{
+	g_return_val_if_fail (name != NULL, NULL);
+
+	return vformat_find_attribute_atom (vcard, vformat_atom_peek (name));
+}
+
 char *vformat_to_string (VFormat *evc, VFormatType type)
 {
-	GList *l;
-	GList *v;
+	guint i;
+	guint v;
 
 	GString *str = g_string_new ("");
 
@@ -936,9 +1744,9 @@ char *vformat_to_string (VFormat *evc, VFormatType type)
 			break;
 	}
 
-	for (l = evc->attributes; l; l = l->next) {
-		GList *p;
-		VFormatAttribute *attr = l->data;
+	for (i = 0; i < PTR_ARRAY_LEN (evc->attributes); i++) {
+		guint p;
+		VFormatAttribute *attr = g_ptr_array_index (evc->attributes, i);
 		GString *attr_str;
 		int l;
 		int format_encoding = VF_ENCODING_RAW;
@@ -950,14 +1758,15 @@ char *vformat_to_string (VFormat *evc, VFormatType type)
 		 * contentline  = [group "."] name *(";" param) ":" value CRLF
 		 */
 
-		if (attr->group) {
-			attr_str = g_string_append (attr_str, attr->group);
+		if (attr->body->group) {
+			attr_str = g_string_append (attr_str, attr->body->group);
 			attr_str = g_string_append_c (attr_str, '.');
 		}
 		attr_str = g_string_append (attr_str, attr->name);
 		/* handle the parameters */
-		for (p = attr->params; p; p = p->next) {
-			VFormatParam *param = p->data;
+		for (p = 0; p < PTR_ARRAY_LEN (attr->body->params); p++) {
+			VFormatParam *param = g_ptr_array_index (attr->body->params, p);
+			guint n_values = PTR_ARRAY_LEN (param->values);
 			/* 5.8.2:
 			 * param        = param-name "=" param-value *("," param-value)
 			 */
@@ -968,32 +1777,32 @@ char *vformat_to_string (VFormat *evc, VFormatType type)
 				 * Character set can only be specified on the CHARSET
 				 * parameter on the Content-Type MIME header field.
 				**/
-				if (!g_ascii_strcasecmp (param->name, "CHARSET"))
+				if (param->name_atom == VF_ATOM_CHARSET)
 					continue;
 				attr_str = g_string_append_c (attr_str, ';');
 				attr_str = g_string_append (attr_str, param->name);
-				if (param->values) {
+				if (n_values) {
 					attr_str = g_string_append_c (attr_str, '=');
 				}
-				for (v = param->values; v; v = v->next) {
-					if (STRING_IS_BASE64(v->data)) {
+				for (v = 0; v < n_values; v++) {
+					const char *value = g_ptr_array_index (param->values, v);
+					/* the param is not touched, its body may be shared
+					   or loaded read-only */
+					if (STRING_IS_BASE64(value)) {
 						format_encoding = VF_ENCODING_BASE64;
 						/*Only the "B" encoding of [RFC 2047] is an allowed*/
-						if (v->data)
-							g_free(v->data);
-
-						v->data = g_strdup("B");
+						value = "B";
 					}
 					/**
 					 * QUOTED-PRINTABLE inline encoding has been
 					 * eliminated.
 					**/
-					if (!g_ascii_strcasecmp (param->name, "ENCODING") && STRING_IS_QP(v->data)) {
+					if (param->name_atom == VF_ATOM_ENCODING && STRING_IS_QP(value)) {
 						format_encoding = VF_ENCODING_QP;
 					}
-					attr_str = g_string_append (attr_str, v->data);
+					attr_str = g_string_append (attr_str, value);
 
-					if (v->next)
+					if (v + 1 < n_values)
 						attr_str = g_string_append_c (attr_str, ',');
 				}
 			}
@@ -1005,27 +1814,31 @@ char *vformat_to_string (VFormat *evc, VFormatType type)
 				 * have a "TYPE=" parameter
 				**/
 				gboolean must_have_type = FALSE;
-				if (!g_ascii_strcasecmp (attr->name, "PHOTO") || !g_ascii_strcasecmp (attr->name, "LOGO") || !g_ascii_strcasecmp (attr->name, "SOUND") )
+				switch (attr->name_atom) {
+				case VF_ATOM_PHOTO:
+				case VF_ATOM_LOGO:
+				case VF_ATOM_SOUND:
 					must_have_type = TRUE;
-				if ( must_have_type || g_ascii_strcasecmp (param->name, "TYPE") )
+					break;
+				default:
+					break;
+				}
+				if ( must_have_type || param->name_atom != VF_ATOM_TYPE )
 					attr_str = g_string_append (attr_str, param->name);
-				if ( param->values && (must_have_type || g_ascii_strcasecmp (param->name, "TYPE")) )
+				if ( n_values && (must_have_type || param->name_atom != VF_ATOM_TYPE) )
 					attr_str = g_string_append_c (attr_str, '=');
-				for (v = param->values; v; v = v->next) {
+				for (v = 0; v < n_values; v++) {
+					const char *value = g_ptr_array_index (param->values, v);
 					// check for quoted-printable encoding
-					if (!g_ascii_strcasecmp (param->name, "ENCODING") && STRING_IS_QP(v->data))
+					if (param->name_atom == VF_ATOM_ENCODING && STRING_IS_QP(value))
 						format_encoding = VF_ENCODING_QP;
 					// check for base64 encoding
-					if (STRING_IS_BASE64(v->data)) {
+					if (STRING_IS_BASE64(value)) {
 						format_encoding = VF_ENCODING_BASE64;
-
-						if (v->data)
-							g_free(v->data);
-
-						v->data = g_strdup("BASE64");
+						value = "BASE64";
 					}
-					attr_str = g_string_append (attr_str, v->data);
-					if (v->next)
+					attr_str = g_string_append (attr_str, value);
+					if (v + 1 < n_values)
 						attr_str = g_string_append_c (attr_str, ',');
 				}
 			}
@@ -1033,30 +1846,35 @@ char *vformat_to_string (VFormat *evc, VFormatType type)
 
 		attr_str = g_string_append_c (attr_str, ':');
 
-		for (v = attr->values; v; v = v->next) {
-			char *value = v->data;
-			char *escaped_value = NULL;
+		if (attr->body->blob) {
+			/* folded while it is encoded, the base64 text of a
+			   large value is never built in one piece */
+			str = g_string_append_len (str, attr_str->str, attr_str->len);
+			_blob_append_folded (str, attr->body->blob,
+					     g_utf8_strlen (attr_str->str, attr_str->len));
+			g_string_truncate (attr_str, 0);
+		}
+
+		for (v = 0; v < PTR_ARRAY_LEN (attr->body->values) && !attr->body->blob; v++) {
+			char *value = g_ptr_array_index (attr->body->values, v);
 
-			if (!g_ascii_strcasecmp (attr->name, "RRULE") &&
+			if (attr->name_atom == VF_ATOM_RRULE &&
 				  !g_ascii_strncasecmp (value, "BYDAY", 5)) {
 				attr_str = g_string_append (attr_str, value);
 			} else {
-				escaped_value = vformat_escape_string (value, type);
-				attr_str = g_string_append (attr_str, escaped_value);
+				vformat_escape_string_append (attr_str, value, -1, type);
 			}
 
-			if (v->next) {
+			if (v + 1 < attr->body->values->len) {
 
 				/* XXX toshok - i hate you, rfc 2426.
 				   why doesn't CATEGORIES use a ; like
 				   a normal list attribute? */
-				if (!g_ascii_strcasecmp (attr->name, "CATEGORIES"))
+				if (attr->name_atom == VF_ATOM_CATEGORIES)
 					attr_str = g_string_append_c (attr_str, ',');
 				else
 					attr_str = g_string_append_c (attr_str, ';');
 			}
-
-			g_free (escaped_value);
 		}
 
 		/* Folding lines:
@@ -1163,26 +1981,25 @@ char *vformat_to_string (VFormat *evc, VFormatType type)
 
 void vformat_dump_structure (VFormat *evc)
 {
-	GList *a;
-	GList *v;
-	int i;
+	guint a;
+	guint v;
+	guint i;
 
 	printf ("VFormat\n");
-	for (a = evc->attributes; a; a = a->next) {
-		GList *p;
-		VFormatAttribute *attr = a->data;
+	for (a = 0; a < PTR_ARRAY_LEN (evc->attributes); a++) {
+		VFormatAttribute *attr = g_ptr_array_index (evc->attributes, a);
 		printf ("+-- %s\n", attr->name);
-		if (attr->params) {
+		if (PTR_ARRAY_LEN (attr->body->params)) {
 			printf ("    +- params=\n");
 
-			for (p = attr->params, i = 0; p; p = p->next, i++) {
-				VFormatParam *param = p->data;
+			for (i = 0; i < attr->body->params->len; i++) {
+				VFormatParam *param = g_ptr_array_index (attr->body->params, i);
 				printf ("    |   [%d] = %s", i,param->name);
 				printf ("(");
-				for (v = param->values; v; v = v->next) {
-					char *value = vformat_escape_string ((char*)v->data, VFORMAT_CARD_21);
+				for (v = 0; v < PTR_ARRAY_LEN (param->values); v++) {
+					char *value = vformat_escape_string ((char*)g_ptr_array_index (param->values, v), VFORMAT_CARD_21);
 					printf ("%s", value);
-					if (v->next)
+					if (v + 1 < param->values->len)
 						printf (",");
 					g_free (value);
 				}
@@ -1191,8 +2008,12 @@ void vformat_dump_structure (VFormat *evc)
 			}
 		}
 		printf ("    +- values=\n");
-		for (v = attr->values, i = 0; v; v = v->next, i++) {
-			printf ("        [%d] = `%s'\n", i, (char*)v->data);
+		if (attr->body->blob) {
+			printf ("        [0] = %lu bytes of binary data\n", (unsigned long) attr->body->blob->len);
+			continue;
+		}
+		for (i = 0; i < PTR_ARRAY_LEN (attr->body->values); i++) {
+			printf ("        [%d] = `%s'\n", i, (char*)g_ptr_array_index (attr->body->values, i));
 		}
 	}
 }
@@ -1202,73 +2023,557 @@ VFormatAttribute *vformat_attribute_new (const char *attr_group, const char *att
 	VFormatAttribute *attr;
 
 	attr = g_new0 (VFormatAttribute, 1);
+	attr->body = g_new0 (VFormatAttributeBody, 1);
+	attr->body->ref_count = 1;
 
-	attr->group = g_strdup (attr_group);
-	attr->name = g_strdup (attr_name);
+	attr->body->group = g_strdup (attr_group);
+	if (attr_name) {
+		attr->name_atom = vformat_atom_intern (attr_name);
+		attr->name = vformat_atom_to_string (attr->name_atom);
+	}
 
 	return attr;
 }
 
+static void
+free_gstring (GString *str)
+{
+	g_string_free (str, TRUE);
+}
+
+/* a file loaded by vformat_load_binary(), mapped as long as any
+   attribute body points into it */
+struct VFormatMapping {
+	gint ref_count;
+	GMappedFile *file;
+};
+
+static void
+_mapping_unref (VFormatMapping *mapping)
+{
+	if (!g_atomic_int_dec_and_test (&mapping->ref_count))
+		return;
+
+#if GLIB_CHECK_VERSION(2,22,0)
+	g_mapped_file_unref (mapping->file);
+#else
+	g_mapped_file_free (mapping->file);
+#endif
+	g_free (mapping);
+}
+
+/* a param of a mapped body, its strings belong to the file */
+static void
+_param_free_mapped (VFormatParam *param)
+{
+	if (param->values)
+		g_ptr_array_free (param->values, TRUE);
+	g_list_free (param->value_list);
+	g_free (param);
+}
+
+static void
+_attribute_body_unref (VFormatAttributeBody *body)
+{
+	if (!g_atomic_int_dec_and_test (&body->ref_count))
+		return;
+
+	if (!body->mapping)
+		g_free (body->group);
+	if (body->values) {
+		if (!body->mapping)
+			g_ptr_array_foreach (body->values, (GFunc)g_free, NULL);
+		g_ptr_array_free (body->values, TRUE);
+	}
+	if (body->decoded_values) {
+		g_ptr_array_foreach (body->decoded_values, (GFunc)free_gstring, NULL);
+		g_ptr_array_free (body->decoded_values, TRUE);
+	}
+	if (body->params) {
+		g_ptr_array_foreach (body->params, body->mapping ? (GFunc)_param_free_mapped :
+				     (GFunc)vformat_attribute_param_free, NULL);
+		g_ptr_array_free (body->params, TRUE);
+	}
+	if (body->blob)
+		_blob_unref (body->blob);
+	if (body->mapping)
+		_mapping_unref (body->mapping);
+	g_free (body);
+}
+
+/* gives @attr a body of its own before it is modified, also if the
+   body points into a mapped file.  The decoded values are not copied,
+   they are rebuilt on demand. */
+static void
+_attribute_unshare (VFormatAttribute *attr)
+{
+	VFormatAttributeBody *old = attr->body, *body;
+	guint i;
+
+	if (g_atomic_int_get (&old->ref_count) == 1 && !old->mapping)
+		return;
+
+	body = g_new0 (VFormatAttributeBody, 1);
+	body->ref_count = 1;
+	body->group = g_strdup (old->group);
+	if (old->params) {
+		body->params = g_ptr_array_sized_new (old->params->len);
+		for (i = 0; i < old->params->len; i++)
+			g_ptr_array_add (body->params,
+					 vformat_attribute_param_copy (g_ptr_array_index (old->params, i)));
+	}
+	if (old->values) {
+		body->values = g_ptr_array_sized_new (old->values->len);
+		for (i = 0; i < old->values->len; i++)
+			g_ptr_array_add (body->values, g_strdup (g_ptr_array_index (old->values, i)));
+	}
+	if (old->blob)
+		body->blob = _blob_ref (old->blob);
+	body->encoding = old->encoding;
+	body->encoding_set = old->encoding_set;
+	body->type_mask = old->type_mask;
+
+	_attribute_body_unref (old);
+	attr->body = body;
+
+	_drop_view (&attr->param_list);
+	_drop_view (&attr->value_list);
+	_drop_view (&attr->decoded_list);
+}
+
 void
 vformat_attribute_free (VFormatAttribute *attr)
 {
 	g_return_if_fail (attr != NULL);
 
-	g_free (attr->group);
-	g_free (attr->name);
-
-	vformat_attribute_remove_values (attr);
+	_attribute_body_unref (attr->body);
 
-	vformat_attribute_remove_params (attr);
+	g_list_free (attr->param_list);
+	g_list_free (attr->value_list);
+	g_list_free (attr->decoded_list);
 
 	g_free (attr);
 }
 
+/* the copy shares the body of @attr until one of the two is modified */
 VFormatAttribute*
 vformat_attribute_copy (VFormatAttribute *attr)
 {
 	VFormatAttribute *a;
-	GList *p;
 
 	g_return_val_if_fail (attr != NULL, NULL);
 
-	a = vformat_attribute_new (vformat_attribute_get_group (attr),
-				   vformat_attribute_get_name (attr));
+	a = g_new0 (VFormatAttribute, 1);
+	a->name = attr->name;
+	a->name_atom = attr->name_atom;
+	a->body = attr->body;
+	g_atomic_int_inc (&a->body->ref_count);
 
-	for (p = attr->values; p; p = p->next)
-		vformat_attribute_add_value (a, p->data);
+	return a;
+}
 
-	for (p = attr->params; p; p = p->next)
-		vformat_attribute_add_param (a, vformat_attribute_param_copy (p->data));
+VFormat*
+vformat_copy (VFormat *evc)
+{
+	VFormat *copy;
+	guint i;
 
-	return a;
+	g_return_val_if_fail (evc != NULL, NULL);
+
+	copy = vformat_new ();
+	for (i = 0; i < PTR_ARRAY_LEN (evc->attributes); i++)
+		vformat_add_attribute (copy, vformat_attribute_copy (g_ptr_array_index (evc->attributes, i)));
+
+	return copy;
+}
+
+/* Binary cache format.  Everything is a little endian guint32, there
+ * are no pointers, only indices:
+ *
+ *   header      magic "VFMB", version, n_strings, n_formats,
+ *               n_attributes, n_params, n_values, strings_size
+ *   strings     n_strings offsets into the string data
+ *   formats     first attribute, n_attributes
+ *   attributes  group, name, first param, n_params, first value,
+ *               n_values, encoding (bit 8: encoding set), type mask
+ *   params      name, first value, n_values
+ *   values      string, for attribute and param values
+ *   string data NUL terminated strings, each stored once
+ *
+ * Strings are referred to by index, VFB_NONE stands for NULL.  Records
+ * of one format, attribute or param are consecutive. */
+
+#define VFB_MAGIC       "VFMB"
+#define VFB_VERSION     1
+#define VFB_NONE        0xffffffffU
+#define VFB_HEADER_LEN  8
+#define VFB_FORMAT_LEN  2
+#define VFB_ATTR_LEN    8
+#define VFB_PARAM_LEN   3
+
+typedef struct {
+	GHashTable *ids;        /* string -> index + 1 */
+	GArray     *offsets;
+	GString    *data;
+	GArray     *formats;
+	GArray     *attributes;
+	GArray     *params;
+	GArray     *values;
+} BinaryWriter;
+
+static void _bw_put (GArray *array, guint32 v)
+{
+	v = GUINT32_TO_LE (v);
+	g_array_append_val (array, v);
+}
+
+static guint32 _bw_string (BinaryWriter *bw, const char *str)
+{
+	guint32 id;
+
+	if (!str)
+		return VFB_NONE;
+
+	id = GPOINTER_TO_UINT (g_hash_table_lookup (bw->ids, str));
+	if (id)
+		return id - 1;
+
+	id = bw->offsets->len;
+	_bw_put (bw->offsets, bw->data->len);
+	g_string_append_len (bw->data, str, strlen (str) + 1);
+	g_hash_table_insert (bw->ids, (gpointer) str, GUINT_TO_POINTER (id + 1));
+
+	return id;
+}
+
+static void _bw_values (BinaryWriter *bw, GPtrArray *values)
+{
+	guint i;
+
+	for (i = 0; i < PTR_ARRAY_LEN (values); i++)
+		_bw_put (bw->values, _bw_string (bw, g_ptr_array_index (values, i)));
+}
+
+static void _bw_array (GString *out, GArray *array)
+{
+	g_string_append_len (out, array->data, array->len * sizeof (guint32));
+	g_array_free (array, TRUE);
+}
+
+/* serializes the VFormat* in @formats to a newly allocated buffer of
+   *@len bytes, to be read back with vformat_load_binary() */
+gchar *
+vformat_serialize_binary (GPtrArray *formats, gsize *len)
+{
+	BinaryWriter bw;
+	GArray *header;
+	GString *out;
+	guint f, a, p;
+
+	g_return_val_if_fail (formats != NULL, NULL);
+
+	bw.ids = g_hash_table_new (g_str_hash, g_str_equal);
+	bw.offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+	bw.data = g_string_new ("");
+	bw.formats = g_array_new (FALSE, FALSE, sizeof (guint32));
+	bw.attributes = g_array_new (FALSE, FALSE, sizeof (guint32));
+	bw.params = g_array_new (FALSE, FALSE, sizeof (guint32));
+	bw.values = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	for (f = 0; f < formats->len; f++) {
+		VFormat *evc = g_ptr_array_index (formats, f);
+
+		_bw_put (bw.formats, bw.attributes->len / VFB_ATTR_LEN);
+		_bw_put (bw.formats, PTR_ARRAY_LEN (evc->attributes));
+
+		for (a = 0; a < PTR_ARRAY_LEN (evc->attributes); a++) {
+			VFormatAttribute *attr = g_ptr_array_index (evc->attributes, a);
+			VFormatAttributeBody *body = attr->body;
+
+			_attribute_blob_text (attr);
+			_bw_put (bw.attributes, _bw_string (&bw, body->group));
+			_bw_put (bw.attributes, _bw_string (&bw, attr->name));
+			_bw_put (bw.attributes, bw.params->len / VFB_PARAM_LEN);
+			_bw_put (bw.attributes, PTR_ARRAY_LEN (body->params));
+			_bw_put (bw.attributes, bw.values->len);
+			_bw_put (bw.attributes, PTR_ARRAY_LEN (body->values));
+			_bw_put (bw.attributes, body->encoding | (body->encoding_set ? 0x100 : 0));
+			_bw_put (bw.attributes, body->type_mask);
+			_bw_values (&bw, body->values);
+
+			for (p = 0; p < PTR_ARRAY_LEN (body->params); p++) {
+				VFormatParam *param = g_ptr_array_index (body->params, p);
+
+				_bw_put (bw.params, _bw_string (&bw, param->name));
+				_bw_put (bw.params, bw.values->len);
+				_bw_put (bw.params, PTR_ARRAY_LEN (param->values));
+				_bw_values (&bw, param->values);
+			}
+		}
+	}
+
+	header = g_array_new (FALSE, FALSE, sizeof (guint32));
+	g_array_append_vals (header, VFB_MAGIC, 1);
+	_bw_put (header, VFB_VERSION);
+	_bw_put (header, bw.offsets->len);
+	_bw_put (header, formats->len);
+	_bw_put (header, bw.attributes->len / VFB_ATTR_LEN);
+	_bw_put (header, bw.params->len / VFB_PARAM_LEN);
+	_bw_put (header, bw.values->len);
+	_bw_put (header, bw.data->len);
+
+	out = g_string_sized_new (bw.data->len + (VFB_HEADER_LEN + bw.offsets->len + bw.formats->len +
+	                                          bw.attributes->len + bw.params->len +
+	                                          bw.values->len) * sizeof (guint32));
+	_bw_array (out, header);
+	_bw_array (out, bw.offsets);
+	_bw_array (out, bw.formats);
+	_bw_array (out, bw.attributes);
+	_bw_array (out, bw.params);
+	_bw_array (out, bw.values);
+	g_string_append_len (out, bw.data->str, bw.data->len);
+
+	g_string_free (bw.data, TRUE);
+	g_hash_table_destroy (bw.ids);
+
+	*len = out->len;
+	return g_string_free (out, FALSE);
+}
+
+typedef struct {
+	const guint32 *offsets;
+	const guint32 *formats;
+	const guint32 *attributes;
+	const guint32 *params;
+	const guint32 *values;
+	const char    *data;
+	guint32 n_strings, n_formats, n_attributes, n_params, n_values, strings_size;
+	VFormatAtom   *atoms;   /* interned names, by string index */
+	VFormatMapping *mapping;
+} BinaryReader;
+
+#define VFB_GET(p, i) GUINT32_FROM_LE ((p)[i])
+
+static const char *_br_string (BinaryReader *br, guint32 id)
+{
+	return id == VFB_NONE ? NULL : br->data + VFB_GET (br->offsets, id);
+}
+
+static VFormatAtom _br_atom (BinaryReader *br, guint32 id)
+{
+	if (!br->atoms[id])
+		br->atoms[id] = vformat_atom_intern (_br_string (br, id));
+	return br->atoms[id];
+}
+
+static GPtrArray *_br_values (BinaryReader *br, guint32 first, guint32 n)
+{
+	GPtrArray *values;
+	guint32 i;
+
+	if (!n)
+		return NULL;
+	values = g_ptr_array_sized_new (n);
+	for (i = 0; i < n; i++)
+		g_ptr_array_add (values, (gpointer) _br_string (br, VFB_GET (br->values, first + i)));
+
+	return values;
+}
+
+/* TRUE if every index in the records stays within its table */
+static gboolean _br_check (BinaryReader *br)
+{
+	guint32 i, k;
+
+	if (br->n_strings && (!br->strings_size || br->data[br->strings_size - 1] != '\0'))
+		return FALSE;
+	for (i = 0; i < br->n_strings; i++) {
+		if (VFB_GET (br->offsets, i) >= br->strings_size)
+			return FALSE;
+	}
+	for (i = 0; i < br->n_values; i++) {
+		k = VFB_GET (br->values, i);
+		if (k != VFB_NONE && k >= br->n_strings)
+			return FALSE;
+	}
+	for (i = 0; i < br->n_formats; i++) {
+		const guint32 *r = br->formats + i * VFB_FORMAT_LEN;
+		if ((guint64) VFB_GET (r, 0) + VFB_GET (r, 1) > br->n_attributes)
+			return FALSE;
+	}
+	for (i = 0; i < br->n_attributes; i++) {
+		const guint32 *r = br->attributes + i * VFB_ATTR_LEN;
+		if ((VFB_GET (r, 0) != VFB_NONE && VFB_GET (r, 0) >= br->n_strings) ||
+		    VFB_GET (r, 1) >= br->n_strings ||
+		    (guint64) VFB_GET (r, 2) + VFB_GET (r, 3) > br->n_params ||
+		    (guint64) VFB_GET (r, 4) + VFB_GET (r, 5) > br->n_values)
+			return FALSE;
+	}
+	for (i = 0; i < br->n_params; i++) {
+		const guint32 *r = br->params + i * VFB_PARAM_LEN;
+		if (VFB_GET (r, 0) >= br->n_strings ||
+		    (guint64) VFB_GET (r, 1) + VFB_GET (r, 2) > br->n_values)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static VFormatAttribute *_br_attribute (BinaryReader *br, guint32 index)
+{
+	const guint32 *r = br->attributes + index * VFB_ATTR_LEN;
+	VFormatAttribute *attr;
+	VFormatAttributeBody *body;
+	guint32 p, n_params = VFB_GET (r, 3);
+
+	attr = g_new0 (VFormatAttribute, 1);
+	attr->name_atom = _br_atom (br, VFB_GET (r, 1));
+	attr->name = vformat_atom_to_string (attr->name_atom);
+
+	attr->body = body = g_new0 (VFormatAttributeBody, 1);
+	body->ref_count = 1;
+	body->mapping = br->mapping;
+	g_atomic_int_inc (&br->mapping->ref_count);
+	body->group = (char *) _br_string (br, VFB_GET (r, 0));
+	body->values = _br_values (br, VFB_GET (r, 4), VFB_GET (r, 5));
+	body->encoding = VFB_GET (r, 6) & 0xff;
+	body->encoding_set = (VFB_GET (r, 6) & 0x100) != 0;
+	body->type_mask = VFB_GET (r, 7);
+
+	if (n_params)
+		body->params = g_ptr_array_sized_new (n_params);
+	for (p = VFB_GET (r, 2); p < VFB_GET (r, 2) + n_params; p++) {
+		const guint32 *pr = br->params + p * VFB_PARAM_LEN;
+		VFormatParam *param = g_new0 (VFormatParam, 1);
+
+		param->name_atom = _br_atom (br, VFB_GET (pr, 0));
+		param->name = vformat_atom_to_string (param->name_atom);
+		param->values = _br_values (br, VFB_GET (pr, 1), VFB_GET (pr, 2));
+		g_ptr_array_add (body->params, param);
+	}
+
+	return attr;
+}
+
+/* Maps a file written from vformat_serialize_binary() and builds the
+   VFormats on top of it: the strings are not copied, they point into
+   the mapped file, which stays mapped as long as any attribute loaded
+   from it is alive.  Modifying such an attribute gives it its own
+   copy of the data.  Returns a GPtrArray of VFormat*, owned by the
+   caller, or NULL with @error set. */
+GPtrArray *
+vformat_load_binary (const char *filename, GError **error)
+{
+	GMappedFile *file;
+	BinaryReader br;
+	const guint32 *h;
+	const char *contents;
+	GPtrArray *formats;
+	gsize len;
+	guint64 need;
+	guint32 f, a;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	file = g_mapped_file_new (filename, FALSE, error);
+	if (!file)
+		return NULL;
+
+	contents = g_mapped_file_get_contents (file);
+	len = g_mapped_file_get_length (file);
+	h = (const guint32 *) contents;
+
+	if (len < VFB_HEADER_LEN * sizeof (guint32) || memcmp (contents, VFB_MAGIC, 4) ||
+	    VFB_GET (h, 1) != VFB_VERSION)
+		goto bad;
+
+	br.n_strings = VFB_GET (h, 2);
+	br.n_formats = VFB_GET (h, 3);
+	br.n_attributes = VFB_GET (h, 4);
+	br.n_params = VFB_GET (h, 5);
+	br.n_values = VFB_GET (h, 6);
+	br.strings_size = VFB_GET (h, 7);
+
+	need = ((guint64) VFB_HEADER_LEN + br.n_strings +
+	        (guint64) br.n_formats * VFB_FORMAT_LEN +
+	        (guint64) br.n_attributes * VFB_ATTR_LEN +
+	        (guint64) br.n_params * VFB_PARAM_LEN + br.n_values) * sizeof (guint32) +
+		br.strings_size;
+	if (need != len)
+		goto bad;
+
+	br.offsets = h + VFB_HEADER_LEN;
+	br.formats = br.offsets + br.n_strings;
+	br.attributes = br.formats + br.n_formats * VFB_FORMAT_LEN;
+	br.params = br.attributes + br.n_attributes * VFB_ATTR_LEN;
+	br.values = br.params + br.n_params * VFB_PARAM_LEN;
+	br.data = (const char *) (br.values + br.n_values);
+
+	if (!_br_check (&br))
+		goto bad;
+
+	br.atoms = g_new0 (VFormatAtom, br.n_strings);
+	br.mapping = g_new0 (VFormatMapping, 1);
+	br.mapping->ref_count = 1;
+	br.mapping->file = file;
+
+	formats = g_ptr_array_sized_new (br.n_formats);
+	for (f = 0; f < br.n_formats; f++) {
+		const guint32 *r = br.formats + f * VFB_FORMAT_LEN;
+		VFormat *evc = vformat_new ();
+
+		for (a = VFB_GET (r, 0); a < VFB_GET (r, 0) + VFB_GET (r, 1); a++)
+			vformat_add_attribute (evc, _br_attribute (&br, a));
+		g_ptr_array_add (formats, evc);
+	}
+
+	g_free (br.atoms);
+	_mapping_unref (br.mapping);
+
+	return formats;
+
+ bad:
+	g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+	             "'%s' is not a valid vformat cache file", filename);
+#if GLIB_CHECK_VERSION(2,22,0)
+	g_mapped_file_unref (file);
+#else
+	g_mapped_file_free (file);
+#endif
+	return NULL;
 }
 
 void
 vformat_remove_attributes (VFormat *evc, const char *attr_group, const char *attr_name)
 {
-	GList *attr;
+	guint i, kept;
+	VFormatAtom atom;
 
 	g_return_if_fail (attr_name != NULL);
 
-	attr = evc->attributes;
-	while (attr) {
-		GList *next_attr;
-		VFormatAttribute *a = attr->data;
+	atom = vformat_atom_peek (attr_name);
+	if (!evc->attributes || atom == VF_ATOM_UNKNOWN)
+		return;
 
-		next_attr = attr->next;
+	/* compact the array in place, keeping the card order */
+	for (i = 0, kept = 0; i < evc->attributes->len; i++) {
+		VFormatAttribute *a = g_ptr_array_index (evc->attributes, i);
 
-		if (((!attr_group && !a->group) ||
-		     (attr_group && !g_ascii_strcasecmp (attr_group, a->group))) &&
-		    ((!attr_name && !a->name) || !g_ascii_strcasecmp (attr_name, a->name))) {
+		if (((!attr_group && !a->body->group) ||
+		     (attr_group && a->body->group && !g_ascii_strcasecmp (attr_group, a->body->group))) &&
+		    a->name_atom == atom) {
 
 			/* matches, remove/delete the attribute */
-			evc->attributes = g_list_remove_link (evc->attributes, attr);
-
 			vformat_attribute_free (a);
 		}
+		else
+			g_ptr_array_index (evc->attributes, kept++) = a;
+	}
 
-		attr = next_attr;
+	if (kept != evc->attributes->len) {
+		g_ptr_array_set_size (evc->attributes, kept);
+		_name_index_rebuild (evc, evc->name_index_size);
+		_drop_view (&evc->attribute_list);
 	}
 }
 
@@ -1277,7 +2582,10 @@ vformat_remove_attribute (VFormat *evc, VFormatAttribute *attr)
 {
 	g_return_if_fail (attr != NULL);
 
-	evc->attributes = g_list_remove (evc->attributes, attr);
+	if (evc->attributes && g_ptr_array_remove (evc->attributes, attr)) {
+		_name_index_rebuild (evc, evc->name_index_size);
+		_drop_view (&evc->attribute_list);
+	}
 	vformat_attribute_free (attr);
 }
 
@@ -1286,7 +2594,13 @@ vformat_add_attribute (VFormat *evc, VFormatAttribute *attr)
 {
 	g_return_if_fail (attr != NULL);
 
-	evc->attributes = g_list_append (evc->attributes, attr);
+	_array_append (&evc->attributes, attr, &evc->attribute_list);
+
+	/* keep the name index at most half full */
+	if (evc->attributes->len * 2 > evc->name_index_size)
+		_name_index_rebuild (evc, MAX (16, evc->name_index_size * 2));
+	else
+		_name_index_insert (evc, evc->attributes->len - 1);
 }
 
 void
@@ -1324,7 +2638,10 @@ vformat_attribute_add_value (VFormatAttribute *attr, const char *value)
 {
 	g_return_if_fail (attr != NULL);
 
-	attr->values = g_list_append (attr->values, g_strdup (value));
+	_attribute_unshare (attr);
+	_attribute_drop_blob (attr);
+
+	_array_append (&attr->body->values, g_strdup (value), &attr->value_list);
 }
 
 void
@@ -1332,7 +2649,10 @@ vformat_attribute_add_value_decoded (VFormatAttribute *attr, const char *value,
 {
 	g_return_if_fail (attr != NULL);
 
-	switch (attr->encoding) {
+	_attribute_unshare (attr);
+	_attribute_drop_blob (attr);
+
+	switch (attr->body->encoding) {
 		case VF_ENCODING_RAW:
 			break;
 		case VF_ENCODING_BASE64: {
@@ -1342,8 +2662,8 @@ vformat_attribute_add_value_decoded (VFormatAttribute *attr, const char *value,
 			/* make sure the decoded list is up to date */
 			vformat_attribute_get_values_decoded (attr);
 
-			attr->values = g_list_append (attr->values, b64_data);
-			attr->decoded_values = g_list_append (attr->decoded_values, decoded);
+			_array_append (&attr->body->values, b64_data, &attr->value_list);
+			_array_append (&attr->body->decoded_values, decoded, &attr->decoded_list);
 			break;
 		}
 		case VF_ENCODING_QP: {
@@ -1353,8 +2673,8 @@ vformat_attribute_add_value_decoded (VFormatAttribute *attr, const char *value,
 			/* make sure the decoded list is up to date */
 			vformat_attribute_get_values_decoded (attr);
 
-			attr->values = g_list_append (attr->values, qp_data);
-			attr->decoded_values = g_list_append (attr->decoded_values, decoded);
+			_array_append (&attr->body->values, qp_data, &attr->value_list);
+			_array_append (&attr->body->decoded_values, decoded, &attr->decoded_list);
 			break;
 		}
 		case VF_ENCODING_8BIT: {
@@ -1364,8 +2684,8 @@ vformat_attribute_add_value_decoded (VFormatAttribute *attr, const char *value,
 			/* make sure the decoded list is up to date */
 			vformat_attribute_get_values_decoded (attr);
 
-			attr->values = g_list_append (attr->values, data);
-			attr->decoded_values = g_list_append (attr->decoded_values, decoded);
+			_array_append (&attr->body->values, data, &attr->value_list);
+			_array_append (&attr->body->decoded_values, decoded, &attr->decoded_list);
 			break;
 		}
 	}
@@ -1388,24 +2708,27 @@ vformat_attribute_add_values (VFormatAttribute *attr, ...)
 	va_end (ap);
 }
 
-static void
-free_gstring (GString *str)
-{
-	g_string_free (str, TRUE);
-}
-
 void
 vformat_attribute_remove_values (VFormatAttribute *attr)
 {
 	g_return_if_fail (attr != NULL);
 
-	g_list_foreach (attr->values, (GFunc)g_free, NULL);
-	g_list_free (attr->values);
-	attr->values = NULL;
+	_attribute_unshare (attr);
+	_attribute_drop_blob (attr);
 
-	g_list_foreach (attr->decoded_values, (GFunc)free_gstring, NULL);
-	g_list_free (attr->decoded_values);
-	attr->decoded_values = NULL;
+	if (attr->body->values) {
+		g_ptr_array_foreach (attr->body->values, (GFunc)g_free, NULL);
+		g_ptr_array_free (attr->body->values, TRUE);
+		attr->body->values = NULL;
+	}
+	_drop_view (&attr->value_list);
+
+	if (attr->body->decoded_values) {
+		g_ptr_array_foreach (attr->body->decoded_values, (GFunc)free_gstring, NULL);
+		g_ptr_array_free (attr->body->decoded_values, TRUE);
+		attr->body->decoded_values = NULL;
+	}
+	_drop_view (&attr->decoded_list);
 }
 
 void
@@ -1413,20 +2736,29 @@ vformat_attribute_remove_params (VFormatAttribute *attr)
 {
 	g_return_if_fail (attr != NULL);
 
-	g_list_foreach (attr->params, (GFunc)vformat_attribute_param_free, NULL);
-	g_list_free (attr->params);
-	attr->params = NULL;
+	_attribute_unshare (attr);
+
+	if (attr->body->params) {
+		g_ptr_array_foreach (attr->body->params, (GFunc)vformat_attribute_param_free, NULL);
+		g_ptr_array_free (attr->body->params, TRUE);
+		attr->body->params = NULL;
+	}
+	_drop_view (&attr->param_list);
 
 	/* also remove the cached encoding on this attribute */
-	attr->encoding_set = FALSE;
-	attr->encoding = VF_ENCODING_RAW;
+	attr->body->encoding_set = FALSE;
+	attr->body->encoding = VF_ENCODING_RAW;
+	attr->body->type_mask = 0;
 }
 
 VFormatParam*
 vformat_attribute_param_new (const char *name)
 {
 	VFormatParam *param = g_new0 (VFormatParam, 1);
-	param->name = g_strdup (name);
+	if (name) {
+		param->name_atom = vformat_atom_intern (name);
+		param->name = vformat_atom_to_string (param->name_atom);
+	}
 
 	return param;
 }
@@ -1436,8 +2768,6 @@ vformat_attribute_param_free (VFormatParam *param)
 {
 	g_return_if_fail (param != NULL);
 
-	g_free (param->name);
-
 	vformat_attribute_param_remove_values (param);
 
 	g_free (param);
@@ -1447,47 +2777,107 @@ VFormatParam*
 vformat_attribute_param_copy (VFormatParam *param)
 {
 	VFormatParam *p;
-	GList *l;
+	guint i;
 
 	g_return_val_if_fail (param != NULL, NULL);
 
 	p = vformat_attribute_param_new (vformat_attribute_param_get_name (param));
 
-	for (l = param->values; l; l = l->next) {
-		vformat_attribute_param_add_value (p, l->data);
+	for (i = 0; i < PTR_ARRAY_LEN (param->values); i++) {
+		vformat_attribute_param_add_value (p, g_ptr_array_index (param->values, i));
 	}
 
 	return p;
 }
 
+static guint32
+_type_flag (VFormatAtom atom)
+{
+	switch (atom) {
+	case VF_ATOM_INTERNET: return VF_TYPE_INTERNET;
+	case VF_ATOM_HOME:     return VF_TYPE_HOME;
+	case VF_ATOM_WORK:     return VF_TYPE_WORK;
+	case VF_ATOM_CELL:     return VF_TYPE_CELL;
+	case VF_ATOM_VOICE:    return VF_TYPE_VOICE;
+	case VF_ATOM_FAX:      return VF_TYPE_FAX;
+	case VF_ATOM_PREF:     return VF_TYPE_PREF;
+	case VF_ATOM_MSG:      return VF_TYPE_MSG;
+	case VF_ATOM_PAGER:    return VF_TYPE_PAGER;
+	case VF_ATOM_BBS:      return VF_TYPE_BBS;
+	case VF_ATOM_MODEM:    return VF_TYPE_MODEM;
+	case VF_ATOM_CAR:      return VF_TYPE_CAR;
+	case VF_ATOM_ISDN:     return VF_TYPE_ISDN;
+	case VF_ATOM_VIDEO:    return VF_TYPE_VIDEO;
+	case VF_ATOM_PCS:      return VF_TYPE_PCS;
+	case VF_ATOM_DOM:      return VF_TYPE_DOM;
+	case VF_ATOM_INTL:     return VF_TYPE_INTL;
+	case VF_ATOM_POSTAL:   return VF_TYPE_POSTAL;
+	case VF_ATOM_PARCEL:   return VF_TYPE_PARCEL;
+	case VF_ATOM_X400:     return VF_TYPE_X400;
+	default:               return 0;
+	}
+}
+
+static guint32
+_param_type_mask (VFormatParam *param)
+{
+	guint32 mask = 0;
+	guint i;
+
+	switch (param->name_atom) {
+	case VF_ATOM_TYPE:
+		for (i = 0; i < PTR_ARRAY_LEN (param->values); i++)
+			mask |= _type_flag (vformat_atom_peek (g_ptr_array_index (param->values, i)));
+		break;
+	case VF_ATOM_ENCODING:
+		mask = VF_PARAM_ENCODING;
+		break;
+	case VF_ATOM_CHARSET:
+		mask = VF_PARAM_CHARSET;
+		break;
+	default:
+		/* vcard 2.1 naked type, e.g. EMAIL;INTERNET: */
+		if (!PTR_ARRAY_LEN (param->values))
+			mask = _type_flag (param->name_atom);
+		break;
+	}
+
+	return mask;
+}
+
 void
 vformat_attribute_add_param (VFormatAttribute *attr,
 			     VFormatParam *param)
 {
+	const char *encoding;
+
 	g_return_if_fail (attr != NULL);
 	g_return_if_fail (param != NULL);
 
-	attr->params = g_list_append (attr->params, param);
+	_attribute_unshare (attr);
+	_array_append (&attr->body->params, param, &attr->param_list);
+	attr->body->type_mask |= _param_type_mask (param);
 
 	/* we handle our special encoding stuff here */
 
-	if (!g_ascii_strcasecmp (param->name, "ENCODING")) {
-		if (attr->encoding_set) {
+	if (param->name_atom == VF_ATOM_ENCODING) {
+		if (attr->body->encoding_set) {
 			return;
 		}
 
-		if (param->values && param->values->data) {
-			if (STRING_IS_BASE64(param->values->data))
-				attr->encoding = VF_ENCODING_BASE64;
-			else if (STRING_IS_QP(param->values->data))
-				attr->encoding = VF_ENCODING_QP;
-			else if (STRING_IS_8BIT(param->values->data))
-				attr->encoding = VF_ENCODING_8BIT;
+		encoding = vformat_attribute_param_get_nth_value (param, 0);
+		if (encoding) {
+			if (STRING_IS_BASE64(encoding))
+				attr->body->encoding = VF_ENCODING_BASE64;
+			else if (STRING_IS_QP(encoding))
+				attr->body->encoding = VF_ENCODING_QP;
+			else if (STRING_IS_8BIT(encoding))
+				attr->body->encoding = VF_ENCODING_8BIT;
 			else {
 			  ;
 			}
 
-			attr->encoding_set = TRUE;
+			attr->body->encoding_set = TRUE;
 		}
 		else {
 		  ;
@@ -1498,10 +2888,14 @@ vformat_attribute_add_param (VFormatAttribute *attr,
 VFormatParam *vformat_attribute_find_param(VFormatAttribute *attr, const char *name)
 {
 	g_return_val_if_fail (attr != NULL, NULL);
-	GList *p = NULL;
-	for (p = attr->params; p; p = p->next) {
-		VFormatParam *param = p->data;
-		if (!g_ascii_strcasecmp (param->name, name))
+	g_return_val_if_fail (name != NULL, NULL);
+	guint i;
+	VFormatAtom atom = vformat_atom_peek (name);
+	if (atom == VF_ATOM_UNKNOWN)
+		return NULL;
+	for (i = 0; i < PTR_ARRAY_LEN (attr->body->params); i++) {
+		VFormatParam *param = g_ptr_array_index (attr->body->params, i);
+		if (param->name_atom == atom)
 			return param;
 	}
 	return NULL;
@@ -1512,12 +2906,14 @@ vformat_attribute_set_value (VFormatAttribute *attr,
 				int nth, const char *value)
 {
 	g_assert(value);
+	g_return_if_fail (nth >= 0 && nth < PTR_ARRAY_LEN (attr->body->values));
 
-	GList *param = g_list_nth(attr->values, nth);
-	g_free(param->data);
+	_attribute_unshare (attr);
+	_attribute_drop_blob (attr);
 
-	if (strlen(value))
-		param->data = g_strdup(value);
+	g_free (g_ptr_array_index (attr->body->values, nth));
+	g_ptr_array_index (attr->body->values, nth) = g_strdup (value);
+	_drop_view (&attr->value_list);
 }
 
 void
@@ -1526,7 +2922,7 @@ vformat_attribute_param_add_value (VFormatParam *param,
 {
 	g_return_if_fail (param != NULL);
 
-	param->values = g_list_append (param->values, g_strdup (value));
+	_array_append (&param->values, g_strdup (value), &param->value_list);
 }
 
 void
@@ -1589,15 +2985,37 @@ vformat_attribute_param_remove_values (VFormatParam *param)
 {
 	g_return_if_fail (param != NULL);
 
-	g_list_foreach (param->values, (GFunc)g_free, NULL);
-	g_list_free (param->values);
-	param->values = NULL;
+	if (param->values) {
+		g_ptr_array_foreach (param->values, (GFunc)g_free, NULL);
+		g_ptr_array_free (param->values, TRUE);
+		param->values = NULL;
+	}
+	_drop_view (&param->value_list);
 }
 
 GList*
 vformat_get_attributes (VFormat *format)
 {
-	return format->attributes;
+	return _array_view (format->attributes, &format->attribute_list);
+}
+
+guint
+vformat_get_n_attributes (VFormat *format)
+{
+	g_return_val_if_fail (format != NULL, 0);
+
+	return PTR_ARRAY_LEN (format->attributes);
+}
+
+VFormatAttribute*
+vformat_get_nth_attribute (VFormat *format, guint nth)
+{
+	g_return_val_if_fail (format != NULL, NULL);
+
+	if (nth >= PTR_ARRAY_LEN (format->attributes))
+		return NULL;
+
+	return g_ptr_array_index (format->attributes, nth);
 }
 
 const char*
@@ -1605,7 +3023,7 @@ vformat_attribute_get_group (VFormatAttribute *attr)
 {
 	g_return_val_if_fail (attr != NULL, NULL);
 
-	return attr->group;
+	return attr->body->group;
 }
 
 const char*
@@ -1616,49 +3034,96 @@ vformat_attribute_get_name (VFormatAttribute *attr)
 	return attr->name;
 }
 
+VFormatAtom
+vformat_attribute_get_atom (VFormatAttribute *attr)
+{
+	g_return_val_if_fail (attr != NULL, VF_ATOM_UNKNOWN);
+
+	return attr->name_atom;
+}
+
 GList*
 vformat_attribute_get_values (VFormatAttribute *attr)
 {
 	g_return_val_if_fail (attr != NULL, NULL);
 
-	return attr->values;
+	_attribute_blob_text (attr);
+	return _array_view (attr->body->values, &attr->value_list);
 }
 
-GList*
-vformat_attribute_get_values_decoded (VFormatAttribute *attr)
+guint
+vformat_attribute_get_n_values (VFormatAttribute *attr)
 {
-	g_return_val_if_fail (attr != NULL, NULL);
+	g_return_val_if_fail (attr != NULL, 0);
+
+	return PTR_ARRAY_LEN (attr->body->values);
+}
+
+static void
+_attribute_decode_values (VFormatAttribute *attr)
+{
+	guint i;
+
+	if (attr->body->blob) {
+		/* straight from the bytes, the raw text is not made.  Like a
+		   value that was not made a blob, it decodes to the base64
+		   text unless the attribute has an ENCODING of its own. */
+		VFormatBlob *blob = attr->body->blob;
+		GString *decoded;
+
+		if (attr->body->encoding == VF_ENCODING_BASE64)
+			decoded = g_string_new_len ((const gchar *) blob->data, blob->len);
+		else {
+			decoded = g_string_sized_new (VFORMAT_BASE64_ENCODED_LEN (blob->len));
+			decoded->len = vformat_base64_encode (blob->data, blob->len, decoded->str);
+			decoded->str[decoded->len] = '\0';
+		}
+		_array_append (&attr->body->decoded_values, decoded, &attr->decoded_list);
+		return;
+	}
+
+	for (i = 0; i < PTR_ARRAY_LEN (attr->body->values); i++) {
+		char *value = g_ptr_array_index (attr->body->values, i);
+		GString *decoded;
 
-	if (!attr->decoded_values) {
-		GList *l;
-		switch (attr->encoding) {
+		switch (attr->body->encoding) {
 		case VF_ENCODING_RAW:
 		case VF_ENCODING_8BIT:
-			for (l = attr->values; l; l = l->next)
-				attr->decoded_values = g_list_append (attr->decoded_values, g_string_new ((char*)l->data));
+			decoded = g_string_new (value);
 			break;
-		case VF_ENCODING_BASE64:
-			for (l = attr->values; l; l = l->next) {
-				char *decoded = g_strdup ((char*)l->data);
-				int len = base64_decode_simple (decoded, strlen (decoded));
-				attr->decoded_values = g_list_append (attr->decoded_values, g_string_new_len (decoded, len));
-				g_free (decoded);
-			}
+		case VF_ENCODING_BASE64: {
+			gsize len = strlen (value);
+			decoded = g_string_sized_new (VFORMAT_BASE64_DECODED_LEN (len));
+			decoded->len = vformat_base64_decode (value, len, (guchar *)decoded->str);
+			decoded->str[decoded->len] = '\0';
 			break;
-		case VF_ENCODING_QP:
-			for (l = attr->values; l; l = l->next) {
-				if (!(l->data))
-					continue;
-				char *decoded = g_strdup ((char*)l->data);
-				int len = quoted_decode_simple (decoded, strlen (decoded));
-				attr->decoded_values = g_list_append (attr->decoded_values, g_string_new_len (decoded, len));
-				g_free (decoded);
-			}
+		}
+		case VF_ENCODING_QP: {
+			gsize len;
+			if (!value)
+				continue;
+			len = strlen (value);
+			decoded = g_string_sized_new (len);
+			decoded->len = vformat_qp_decode (value, len, (guchar *)decoded->str);
+			decoded->str[decoded->len] = '\0';
 			break;
 		}
+		default:
+			continue;
+		}
+		_array_append (&attr->body->decoded_values, decoded, &attr->decoded_list);
 	}
+}
+
+GList*
+vformat_attribute_get_values_decoded (VFormatAttribute *attr)
+{
+	g_return_val_if_fail (attr != NULL, NULL);
+
+	if (!attr->body->decoded_values)
+		_attribute_decode_values (attr);
 
-	return attr->decoded_values;
+	return _array_view (attr->body->decoded_values, &attr->decoded_list);
 }
 
 gboolean
@@ -1666,61 +3131,59 @@ vformat_attribute_is_single_valued (VFormatAttribute *attr)
 {
 	g_return_val_if_fail (attr != NULL, FALSE);
 
-	if (attr->values == NULL
-	    || attr->values->next != NULL)
-		return FALSE;
-
-	return TRUE;
+	return PTR_ARRAY_LEN (attr->body->values) == 1;
 }
 
 char*
 vformat_attribute_get_value (VFormatAttribute *attr)
 {
-	GList *values;
-
 	g_return_val_if_fail (attr != NULL, NULL);
 
-	values = vformat_attribute_get_values (attr);
-
 	if (!vformat_attribute_is_single_valued (attr))
 	  ;
 
-	return values ? g_strdup ((char*)values->data) : NULL;
+	_attribute_blob_text (attr);
+	return PTR_ARRAY_LEN (attr->body->values) ? g_strdup (g_ptr_array_index (attr->body->values, 0)) : NULL;
 }
 
 GString*
 vformat_attribute_get_value_decoded (VFormatAttribute *attr)
 {
-	GList *values;
 	GString *str = NULL;
 
 	g_return_val_if_fail (attr != NULL, NULL);
 
-	values = vformat_attribute_get_values_decoded (attr);
+	if (!attr->body->decoded_values)
+		_attribute_decode_values (attr);
 
 	if (!vformat_attribute_is_single_valued (attr))
 	  ;
 
-	if (values)
-		str = values->data;
+	if (PTR_ARRAY_LEN (attr->body->decoded_values))
+		str = g_ptr_array_index (attr->body->decoded_values, 0);
 
 	return str ? g_string_new_len (str->str, str->len) : NULL;
 }
 
 const char *vformat_attribute_get_nth_value(VFormatAttribute *attr, int nth)
 {
-	GList *values = vformat_attribute_get_values_decoded(attr);
-	if (!values)
+	GString *retstr;
+
+	g_return_val_if_fail (attr != NULL, NULL);
+
+	if (!attr->body->decoded_values)
+		_attribute_decode_values (attr);
+	if (nth < 0 || nth >= PTR_ARRAY_LEN (attr->body->decoded_values))
 		return NULL;
-	GString *retstr = (GString *)g_list_nth_data(values, nth);
+	retstr = g_ptr_array_index (attr->body->decoded_values, nth);
 	if (!retstr)
 		return NULL;
 
 	if (!g_utf8_validate(retstr->str, -1, NULL)) {
-		values = vformat_attribute_get_values(attr);
-		if (!values)
+		if (nth >= PTR_ARRAY_LEN (attr->body->values))
 			return NULL;
-		return g_list_nth_data(values, nth);
+		_attribute_blob_text (attr);
+		return g_ptr_array_index (attr->body->values, nth);
 	}
 
 	return retstr->str;
@@ -1729,23 +3192,22 @@ const char *vformat_attribute_get_nth_value(VFormatAttribute *attr, int nth)
 gboolean
 vformat_attribute_has_type (VFormatAttribute *attr, const char *typestr)
 {
-	GList *params;
-	GList *p;
+	guint p, v;
+	guint32 flag;
 
 	g_return_val_if_fail (attr != NULL, FALSE);
 	g_return_val_if_fail (typestr != NULL, FALSE);
 
-	params = vformat_attribute_get_params (attr);
+	/* well-known types are answered from the mask */
+	if ((flag = _type_flag (vformat_atom_peek (typestr))))
+		return (attr->body->type_mask & flag) != 0;
 
-	for (p = params; p; p = p->next) {
-		VFormatParam *param = p->data;
+	for (p = 0; p < PTR_ARRAY_LEN (attr->body->params); p++) {
+		VFormatParam *param = g_ptr_array_index (attr->body->params, p);
 
-		if (!g_strcasecmp (vformat_attribute_param_get_name (param), "TYPE")) {
-			GList *values = vformat_attribute_param_get_values (param);
-			GList *v;
-
-			for (v = values; v; v = v->next) {
-				if (!g_strcasecmp ((char*)v->data, typestr))
+		if (param->name_atom == VF_ATOM_TYPE) {
+			for (v = 0; v < PTR_ARRAY_LEN (param->values); v++) {
+				if (!g_strcasecmp ((char*)g_ptr_array_index (param->values, v), typestr))
 					return TRUE;
 			}
 		}
@@ -1755,19 +3217,20 @@ vformat_attribute_has_type (VFormatAttribute *attr, const char *typestr)
 }
 
 
+guint32
+vformat_attribute_type_mask (VFormatAttribute *attr)
+{
+	g_return_val_if_fail (attr != NULL, 0);
+
+	return attr->body->type_mask;
+}
+
 gboolean vformat_attribute_has_param(VFormatAttribute *attr, const char *name)
 {
 	g_return_val_if_fail (attr != NULL, FALSE);
 	g_return_val_if_fail (name != NULL, FALSE);
 
-	GList *params = vformat_attribute_get_params(attr);
-	GList *p;
-	for (p = params; p; p = p->next) {
-		VFormatParam *param = p->data;
-		if (!g_strcasecmp (name, vformat_attribute_param_get_name(param)))
-			return TRUE;
-	}
-	return FALSE;
+	return vformat_attribute_find_param (attr, name) != NULL;
 }
 
 GList*
@@ -1775,290 +3238,111 @@ vformat_attribute_get_params (VFormatAttribute *attr)
 {
 	g_return_val_if_fail (attr != NULL, NULL);
 
-	return attr->params;
+	return _array_view (attr->body->params, &attr->param_list);
 }
 
-const char*
-vformat_attribute_param_get_name (VFormatParam *param)
+guint
+vformat_attribute_get_n_params (VFormatAttribute *attr)
 {
-	g_return_val_if_fail (param != NULL, NULL);
+	g_return_val_if_fail (attr != NULL, 0);
 
-	return param->name;
+	return PTR_ARRAY_LEN (attr->body->params);
 }
 
-GList*
-vformat_attribute_param_get_values (VFormatParam *param)
+VFormatParam*
+vformat_attribute_get_nth_param (VFormatAttribute *attr, guint nth)
 {
-	g_return_val_if_fail (param != NULL, NULL);
-
-	return param->values;
-}
+	g_return_val_if_fail (attr != NULL, NULL);
 
-const char *vformat_attribute_param_get_nth_value(VFormatParam *param, int nth)
-{
-	const char *ret = NULL;
-	GList *values = vformat_attribute_param_get_values(param);
-	if (!values)
+	if (nth >= PTR_ARRAY_LEN (attr->body->params))
 		return NULL;
-	ret = g_list_nth_data(values, nth);
-	return ret;
-}
 
-static const char *base64_alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-//static unsigned char _evc_base64_rank[256];
+	return g_ptr_array_index (attr->body->params, nth);
+}
 
-static void base64_init(char *rank)
+const char*
+vformat_attribute_param_get_name (VFormatParam *param)
 {
-	int i;
+	g_return_val_if_fail (param != NULL, NULL);
 
-	memset(rank, 0xff, sizeof(rank));
-	for (i=0;i<64;i++) {
-		rank[(unsigned int)base64_alphabet[i]] = i;
-	}
-	rank['='] = 0;
+	return param->name;
 }
 
-/* call this when finished encoding everything, to
-   flush off the last little bit */
-static size_t base64_encode_close(unsigned char *in, size_t inlen, gboolean break_lines, unsigned char *out, int *state, int *save)
+VFormatAtom
+vformat_attribute_param_get_atom (VFormatParam *param)
 {
-	int c1, c2;
-	unsigned char *outptr = out;
-
-	if (inlen>0)
-		outptr += base64_encode_step(in, inlen, break_lines, outptr, state, save);
+	g_return_val_if_fail (param != NULL, VF_ATOM_UNKNOWN);
 
-	c1 = ((unsigned char *)save)[1];
-	c2 = ((unsigned char *)save)[2];
-
-	switch (((char *)save)[0]) {
-	case 2:
-		outptr[2] = base64_alphabet[ ( (c2 &0x0f) << 2 ) ];
-		g_assert(outptr[2] != 0);
-		goto skip;
-	case 1:
-		outptr[2] = '=';
-	skip:
-		outptr[0] = base64_alphabet[ c1 >> 2 ];
-		outptr[1] = base64_alphabet[ c2 >> 4 | ( (c1&0x3) << 4 )];
-		outptr[3] = '=';
-		outptr += 4;
-		break;
-	}
-	if (break_lines)
-		*outptr++ = '\n';
-
-	*save = 0;
-	*state = 0;
-
-	return outptr-out;
+	return param->name_atom;
 }
 
-/*
-  performs an 'encode step', only encodes blocks of 3 characters to the
-  output at a time, saves left-over state in state and save (initialise to
-  0 on first invocation).
-*/
-static size_t base64_encode_step(unsigned char *in, size_t len, gboolean break_lines, unsigned char *out, int *state, int *save)
+GList*
+vformat_attribute_param_get_values (VFormatParam *param)
 {
-	register unsigned char *inptr, *outptr;
-
-	if (len<=0)
-		return 0;
-
-	inptr = in;
-	outptr = out;
-
-	if (len + ((char *)save)[0] > 2) {
-		unsigned char *inend = in+len-2;
-		register int c1, c2, c3;
-		register int already;
-
-		already = *state;
-
-		switch (((char *)save)[0]) {
-		case 1:	c1 = ((unsigned char *)save)[1]; goto skip1;
-		case 2:	c1 = ((unsigned char *)save)[1];
-			c2 = ((unsigned char *)save)[2]; goto skip2;
-		}
-
-		/* yes, we jump into the loop, no i'm not going to change it, it's beautiful! */
-		while (inptr < inend) {
-			c1 = *inptr++;
-		skip1:
-			c2 = *inptr++;
-		skip2:
-			c3 = *inptr++;
-			*outptr++ = base64_alphabet[ c1 >> 2 ];
-			*outptr++ = base64_alphabet[ c2 >> 4 | ( (c1&0x3) << 4 ) ];
-			*outptr++ = base64_alphabet[ ( (c2 &0x0f) << 2 ) | (c3 >> 6) ];
-			*outptr++ = base64_alphabet[ c3 & 0x3f ];
-			/* this is a bit ugly ... */
-			if (break_lines && (++already)>=19) {
-				*outptr++='\n';
-				already = 0;
-			}
-		}
-
-		((char *)save)[0] = 0;
-		len = 2-(inptr-inend);
-		*state = already;
-	}
-
-	if (len>0) {
-		register char *saveout;
-
-		/* points to the slot for the next char to save */
-		saveout = & (((char *)save)[1]) + ((char *)save)[0];
-
-		/* len can only be 0 1 or 2 */
-		switch(len) {
-		case 2:	*saveout++ = *inptr++;
-		case 1:	*saveout++ = *inptr++;
-		}
-		((char *)save)[0]+=len;
-	}
+	g_return_val_if_fail (param != NULL, NULL);
 
-	return outptr-out;
+	return _array_view (param->values, &param->value_list);
 }
 
+guint
+vformat_attribute_param_get_n_values (VFormatParam *param)
+{
+	g_return_val_if_fail (param != NULL, 0);
 
-/**
- * base64_decode_step: decode a chunk of base64 encoded data
- * @in: input stream
- * @len: max length of data to decode
- * @out: output stream
- * @state: holds the number of bits that are stored in @save
- * @save: leftover bits that have not yet been decoded
- *
- * Decodes a chunk of base64 encoded data
- **/
-static size_t base64_decode_step(unsigned char *in, size_t len, unsigned char *out, int *state, unsigned int *save)
-{
-	unsigned char base64_rank[256];
-	base64_init((char*)base64_rank);
-
-	register unsigned char *inptr, *outptr;
-	unsigned char *inend, c;
-	register unsigned int v;
-	int i;
-
-	inend = in+len;
-	outptr = out;
-
-	/* convert 4 base64 bytes to 3 normal bytes */
-	v=*save;
-	i=*state;
-	inptr = in;
-	while (inptr<inend) {
-		c = base64_rank[*inptr++];
-		if (c != 0xff) {
-			v = (v<<6) | c;
-			i++;
-			if (i==4) {
-				*outptr++ = v>>16;
-				*outptr++ = v>>8;
-				*outptr++ = v;
-				i=0;
-			}
-		}
-	}
+	return PTR_ARRAY_LEN (param->values);
+}
 
-	*save = v;
-	*state = i;
+const char *vformat_attribute_param_get_nth_value(VFormatParam *param, int nth)
+{
+	g_return_val_if_fail (param != NULL, NULL);
 
-	/* quick scan back for '=' on the end somewhere */
-	/* fortunately we can drop 1 output char for each trailing = (upto 2) */
-	i=2;
-	while (inptr>in && i) {
-		inptr--;
-		if (base64_rank[*inptr] != 0xff) {
-			if (*inptr == '=' && outptr>out)
-				outptr--;
-			i--;
-		}
-	}
+	if (nth < 0 || nth >= PTR_ARRAY_LEN (param->values))
+		return NULL;
 
-	/* if i!= 0 then there is a truncation error! */
-	return outptr-out;
+	return g_ptr_array_index (param->values, nth);
 }
 
 char *base64_encode_simple (const char *data, size_t len)
 {
-	unsigned char *out;
-	int state = 0, outlen;
-	unsigned int save = 0;
+	char *out;
+	gsize outlen;
 
 	g_return_val_if_fail (data != NULL, NULL);
 
-	out = g_malloc (len * 4 / 3 + 5);
-	outlen = base64_encode_close ((unsigned char *)data, len, FALSE,
-				      out, &state, (int*)&save);
+	out = g_malloc (VFORMAT_BASE64_ENCODED_LEN (len) + 1);
+	outlen = vformat_base64_encode ((const guchar *)data, len, out);
 	out[outlen] = '\0';
-	return (char *)out;
+	return out;
 }
 
 size_t base64_decode_simple (char *data, size_t len)
 {
-	int state = 0;
-	unsigned int save = 0;
-
 	g_return_val_if_fail (data != NULL, 0);
 
-	return base64_decode_step ((unsigned char *)data, len,
-					(unsigned char *)data, &state, &save);
+	return vformat_base64_decode (data, len, (guchar *)data);
 }
 
 char *quoted_encode_simple(const unsigned char *string, int len)
 {
-	GString *tmp = g_string_new("");
-
-	int i = 0;
-	while(string[i] != 0) {
-		if (string[i] > 127 || string[i] == 13 || string[i] == 10 || string[i] == '=') {
-			g_string_append_printf(tmp, "=%02X", string[i]);
-		} else {
-			g_string_append_c(tmp, string[i]);
-		}
-		i++;
-	}
+	char *out;
+	gsize outlen;
 
-	char *ret = tmp->str;
-	g_string_free(tmp, FALSE);
-	return ret;
+	out = g_malloc (VFORMAT_QP_ENCODED_MAX (len) + 1);
+	outlen = vformat_qp_encode (string, len, out);
+	out[outlen] = '\0';
+	return out;
 }
 
 
 size_t quoted_decode_simple (char *data, size_t len)
 {
-	g_return_val_if_fail (data != NULL, 0);
+	gsize outlen;
 
-	GString *string = g_string_new(data);
-	if (!string)
-		return 0;
-
-	char hex[5];
-	hex[4] = 0;
-
-	while (1) {
-		//Get the index of the next encoded char
-		int i = strcspn(string->str, "=");
-		if (i >= strlen(string->str))
-			break;
-
-		strcpy(hex, "0x");
-		strncat(hex, &string->str[i + 1], 2);
-		char rep = ((int)(strtod(hex, NULL)));
-		g_string_erase(string, i, 2);
-		g_string_insert_c(string, i, rep);
-	}
-
-	memset(data, 0, strlen(data));
-	strcpy(data, string->str);
-	g_string_free(string, 1);
+	g_return_val_if_fail (data != NULL, 0);
 
-	return strlen(data);
+	outlen = vformat_qp_decode (data, len, (guchar *)data);
+	data[outlen] = '\0';
+	return outlen;
 }
 
 #undef STRING_IS_BASE64
@@ -30,6 +30,8 @@
 #include <glib.h>
 #include <time.h>
 
+#include "vformat_atoms.h"
+
 typedef enum {
 	VFORMAT_CARD_21,
 	VFORMAT_CARD_30,
@@ -43,7 +45,10 @@ typedef enum {
 
 typedef struct VFormat {
 	//VFormatType type;
-	GList *attributes;
+	GPtrArray *attributes;     /* VFormatAttribute*, in card order */
+	guint     *name_index;     /* open addressing, attribute slot + 1 (0 = empty) */
+	guint      name_index_size;
+	GList     *attribute_list; /* cached view for vformat_get_attributes() */
 } VFormat;
 
 #define CRLF "\r\n"
@@ -55,19 +60,73 @@ typedef enum {
 	VF_ENCODING_8BIT
 } VFormatEncoding;
 
-typedef struct VFormatAttribute {
-	char  *group;
-	char  *name;
-	GList *params; /* VFormatParam */
-	GList *values;
-	GList *decoded_values;
+/* Well-known TYPE values and parameter flags of an attribute, see
+ * vformat_attribute_type_mask().  A vCard 2.1 style naked parameter
+ * (EMAIL;INTERNET:...) counts the same as TYPE=INTERNET. */
+typedef enum {
+	VF_TYPE_INTERNET  = 1 << 0,
+	VF_TYPE_HOME      = 1 << 1,
+	VF_TYPE_WORK      = 1 << 2,
+	VF_TYPE_CELL      = 1 << 3,
+	VF_TYPE_VOICE     = 1 << 4,
+	VF_TYPE_FAX       = 1 << 5,
+	VF_TYPE_PREF      = 1 << 6,
+	VF_TYPE_MSG       = 1 << 7,
+	VF_TYPE_PAGER     = 1 << 8,
+	VF_TYPE_BBS       = 1 << 9,
+	VF_TYPE_MODEM     = 1 << 10,
+	VF_TYPE_CAR       = 1 << 11,
+	VF_TYPE_ISDN      = 1 << 12,
+	VF_TYPE_VIDEO     = 1 << 13,
+	VF_TYPE_PCS       = 1 << 14,
+	VF_TYPE_DOM       = 1 << 15,
+	VF_TYPE_INTL      = 1 << 16,
+	VF_TYPE_POSTAL    = 1 << 17,
+	VF_TYPE_PARCEL    = 1 << 18,
+	VF_TYPE_X400      = 1 << 19,
+
+	VF_PARAM_ENCODING = 1 << 30, /* an ENCODING was given */
+	VF_PARAM_CHARSET  = 1U << 31 /* a CHARSET was given */
+} VFormatTypeFlags;
+
+/* What an attribute holds besides its name.  vformat_attribute_copy()
+ * and vformat_copy() share the body between the copies, the first
+ * modification through one of them gives that attribute a body of its
+ * own (copy on write).  While a body is shared, the params reached
+ * through it must not be modified. */
+typedef struct VFormatMapping VFormatMapping;
+typedef struct VFormatBlob VFormatBlob;
+
+typedef struct VFormatAttributeBody {
+	gint ref_count;
+	VFormatMapping *mapping;   /* set if the strings point into a file
+	                              loaded by vformat_load_binary() */
+	char *group;
+	GPtrArray *params;         /* VFormatParam* */
+	GPtrArray *values;         /* char* */
+	GPtrArray *decoded_values; /* GString*, filled on demand */
+	VFormatBlob *blob;         /* a large base64 value kept out of memory,
+	                              see vformat_set_blob_threshold() */
 	VFormatEncoding encoding;
 	gboolean encoding_set;
+	guint32 type_mask;         /* VFormatTypeFlags */
+} VFormatAttributeBody;
+
+typedef struct VFormatAttribute {
+	const char *name;          /* interned, see vformat_atoms.h */
+	VFormatAtom name_atom;
+	VFormatAttributeBody *body;
+	/* cached GList views for the list accessors below */
+	GList *param_list;
+	GList *value_list;
+	GList *decoded_list;
 } VFormatAttribute;
 
 typedef struct VFormatParam {
-	char     *name;
-	GList    *values;  /* GList of char*'s*/
+	const char *name;          /* interned, see vformat_atoms.h */
+	VFormatAtom name_atom;
+	GPtrArray *values;     /* char* */
+	GList     *value_list; /* cached view for vformat_attribute_param_get_values() */
 } VFormatParam;
 
 
@@ -92,10 +151,32 @@ VFormat *vtodo_new_from_string(const char *str);*/
 VFormat *vformat_new(void);
 VFormat *vformat_new_from_string(const char *str);
 void vformat_free(VFormat *format);
+VFormat *vformat_copy(VFormat *format); /* attributes are shared, see VFormatAttributeBody */
 void vformat_dump_structure(VFormat *format);
 char *vformat_to_string(VFormat *evc, VFormatType type);
 time_t vformat_time_to_unix(const char *inptime);
 
+/* incremental parsing: feed the data in chunks as it arrives, the
+   attributes are built line by line.  vformat_parser_finish() frees the
+   parser and returns the card; vformat_parser_free() discards both. */
+typedef struct VFormatParser VFormatParser;
+
+VFormatParser *vformat_parser_new    (void);
+void           vformat_parser_feed   (VFormatParser *parser, const char *bytes, gsize len);
+VFormat       *vformat_parser_finish (VFormatParser *parser);
+void           vformat_parser_free   (VFormatParser *parser);
+
+/* parses every top level BEGIN...END object in @buf, spread over up to
+   @max_threads worker threads (0: one per CPU).  Returns a GPtrArray of
+   VFormat*, in input order, owned by the caller. */
+GPtrArray *vformat_parse_bulk (const char *buf, gsize len, guint max_threads);
+
+/* compact binary form for caching parsed objects on disk, see the
+   format description in vformat.c.  A loaded VFormat points into the
+   mapped file instead of holding copies of the strings. */
+gchar     *vformat_serialize_binary (GPtrArray *formats, gsize *len);
+GPtrArray *vformat_load_binary      (const char *filename, GError **error);
+
 /* attributes */
 VFormatAttribute *vformat_attribute_new               (const char *attr_group, const char *attr_name);
 void             vformat_attribute_free              (VFormatAttribute *attr);
@@ -129,13 +210,24 @@ void                  vformat_attribute_param_remove_values   (VFormatParam *par
 gboolean vformat_attribute_has_param(VFormatAttribute *attr, const char *name);
 
 /* VFormat* accessors.  nothing returned from these functions should be
-   freed by the caller. */
+   freed by the caller.  The GList accessors return views that are only
+   valid until the next modification of the object they were taken from;
+   prefer the indexed accessors in loops.  Property names are case
+   insensitive (RFC 2425): vformat_find_attribute() matches "email" and
+   "EMAIL" alike, and vformat_attribute_get_name() returns the canonical
+   upper case spelling. */
 GList*           vformat_get_attributes       (VFormat *vformat);
+guint            vformat_get_n_attributes     (VFormat *vformat);
+VFormatAttribute *vformat_get_nth_attribute   (VFormat *vformat, guint nth);
+VFormatAttribute *vformat_find_attribute      (VFormat *vformat, const char *name);
+VFormatAttribute *vformat_find_attribute_atom (VFormat *vformat, VFormatAtom atom);
 const char*      vformat_attribute_get_group  (VFormatAttribute *attr);
 const char*      vformat_attribute_get_name   (VFormatAttribute *attr);
+VFormatAtom      vformat_attribute_get_atom   (VFormatAttribute *attr);
 GList*           vformat_attribute_get_values (VFormatAttribute *attr);  /* GList elements are of type char* */
 GList*           vformat_attribute_get_values_decoded (VFormatAttribute *attr); /* GList elements are of type GString* */
 const char *vformat_attribute_get_nth_value(VFormatAttribute *attr, int nth);
+guint            vformat_attribute_get_n_values (VFormatAttribute *attr);
 
 /* special accessors for single valued attributes */
 gboolean              vformat_attribute_is_single_valued      (VFormatAttribute *attr);
@@ -143,15 +235,47 @@ char*                 vformat_attribute_get_value             (VFormatAttribute
 GString*              vformat_attribute_get_value_decoded     (VFormatAttribute *attr);
 
 GList*           vformat_attribute_get_params       (VFormatAttribute *attr);
+guint            vformat_attribute_get_n_params     (VFormatAttribute *attr);
+VFormatParam*    vformat_attribute_get_nth_param    (VFormatAttribute *attr, guint nth);
 const char*      vformat_attribute_param_get_name   (VFormatParam *param);
+VFormatAtom      vformat_attribute_param_get_atom   (VFormatParam *param);
 GList*           vformat_attribute_param_get_values (VFormatParam *param);
 const char *vformat_attribute_param_get_nth_value(VFormatParam *param, int nth);
+guint            vformat_attribute_param_get_n_values (VFormatParam *param);
+
+/* Base64 values of at least @threshold characters (64k by default, 0
+   turns this off) are decoded into a temporary file while parsing and
+   only kept mapped.  vformat_attribute_get_blob() gives the decoded
+   bytes of such a value, NULL for every other attribute.  The raw and
+   decoded value accessors still work, but make full copies. */
+void             vformat_set_blob_threshold         (gsize threshold);
+gsize            vformat_get_blob_threshold         (void);
+const guchar*    vformat_attribute_get_blob         (VFormatAttribute *attr, gsize *len);
 
 /* special TYPE= parameter predicate (checks for TYPE=@typestr */
 gboolean         vformat_attribute_has_type         (VFormatAttribute *attr, const char *typestr);
 
+/* VFormatTypeFlags of all params, collected when they are added to the
+   attribute.  Values added to a param after it was attached are not
+   reflected. */
+guint32          vformat_attribute_type_mask        (VFormatAttribute *attr);
+
 /* Utility functions. */
 char*            vformat_escape_string (const char *str, VFormatType type);
 char*            vformat_unescape_string (const char *str);
 
+/* the same without a temporary string.  @len is the length of @str, or
+   -1 if it is NUL terminated.  Text without special characters is
+   copied as it is, vformat_string_needs_escape() tells if there are
+   any. */
+gboolean         vformat_string_needs_escape (const char *str, gssize len, VFormatType type);
+void             vformat_escape_string_append (GString *dest, const char *str, gssize len, VFormatType type);
+/* returns the length of the escaped string.  @buf holds it, NUL
+   terminated, only if that is smaller than @buf_size. */
+gsize            vformat_escape_string_to_buffer (const char *str, gssize len, VFormatType type,
+                                                  char *buf, gsize buf_size);
+/* @buf needs room for @len + 1 bytes and may be @str itself, unescaping
+   never makes a string longer.  Returns the unescaped length. */
+gsize            vformat_unescape_string_to_buffer (const char *str, gssize len, char *buf);
+
 #endif /* _VFORMAT_H */
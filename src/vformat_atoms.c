@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ * 
+ */
+
+#define VFORMAT_ATOMS_TABLE
+#include "vformat_atoms.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+/* names that are not in the generated table.  Maps the upper case
+   name to its atom; interned_names holds the name of atom
+   VF_ATOM_N_KNOWN + i at index i.  Nothing is ever removed. */
+G_LOCK_DEFINE_STATIC (interned);
+static GHashTable *interned_atoms = NULL;
+static GPtrArray  *interned_names = NULL;
+
+static VFormatAtom _lookup_known (const char *name)
+{
+	guint32 h = VF_ATOM_HASH_SEED;
+	const char *p;
+	guint slot;
+
+	for (p = name; *p; p++)
+		h = (h ^ (guchar) g_ascii_toupper (*p)) * 16777619U;
+
+	slot = (h + vformat_atom_displace[(h >> 24) % VF_ATOM_N_DISPLACE]) & (VF_ATOM_TABLE_SIZE - 1);
+
+	if (vformat_atom_table[slot].name &&
+	    !g_ascii_strcasecmp (vformat_atom_table[slot].name, name))
+		return vformat_atom_table[slot].atom;
+
+	return VF_ATOM_UNKNOWN;
+}
+
+static VFormatAtom _lookup_interned (const char *name, gboolean add)
+{
+	gchar *upper;
+	gpointer atom = NULL;
+
+	upper = g_ascii_strup (name, -1);
+
+	G_LOCK (interned);
+	if (!interned_atoms) {
+		interned_atoms = g_hash_table_new (g_str_hash, g_str_equal);
+		interned_names = g_ptr_array_new ();
+	}
+	atom = g_hash_table_lookup (interned_atoms, upper);
+	if (!atom && add) {
+		atom = GUINT_TO_POINTER (VF_ATOM_N_KNOWN + interned_names->len);
+		g_ptr_array_add (interned_names, upper);
+		g_hash_table_insert (interned_atoms, upper, atom);
+		upper = NULL;
+	}
+	G_UNLOCK (interned);
+
+	g_free (upper);
+
+	return GPOINTER_TO_UINT (atom);
+}
+
+VFormatAtom vformat_atom_intern (const char *name)
+{
+	VFormatAtom atom;
+
+	g_return_val_if_fail (name != NULL, VF_ATOM_UNKNOWN);
+
+	if ((atom = _lookup_known (name)) != VF_ATOM_UNKNOWN)
+		return atom;
+
+	return _lookup_interned (name, TRUE);
+}
+
+VFormatAtom vformat_atom_peek (const char *name)
+{
+	VFormatAtom atom;
+
+	g_return_val_if_fail (name != NULL, VF_ATOM_UNKNOWN);
+
+	if ((atom = _lookup_known (name)) != VF_ATOM_UNKNOWN)
+		return atom;
+
+	return _lookup_interned (name, FALSE);
+}
+
+const char *vformat_atom_to_string (VFormatAtom atom)
+{
+	const char *name = NULL;
+
+	if (atom < VF_ATOM_N_KNOWN)
+		return vformat_atom_names[atom];
+
+	G_LOCK (interned);
+	if (interned_names && atom - VF_ATOM_N_KNOWN < interned_names->len)
+		name = g_ptr_array_index (interned_names, atom - VF_ATOM_N_KNOWN);
+	G_UNLOCK (interned);
+
+	return name;
+}
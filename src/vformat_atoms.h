@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ * 
+ */
+
+/* Property and parameter names as integer atoms.
+ *
+ * The names listed in vformat_atoms.list map to the fixed VF_ATOM_*
+ * values through a generated perfect hash table.  Every other name
+ * (X- extensions and whatever else a client sends) is interned at
+ * runtime and gets an atom >= VF_ATOM_N_KNOWN.  Lookups are case
+ * insensitive, the canonical spelling is upper case. */
+
+#ifndef _VFORMAT_ATOMS_H
+#define _VFORMAT_ATOMS_H
+
+#include <glib.h>
+
+#include "vformat_atoms_gen.h"
+
+/* returns the atom for @name, interning it if it is not known yet */
+VFormatAtom  vformat_atom_intern  (const char *name);
+
+/* like vformat_atom_intern(), but returns VF_ATOM_UNKNOWN instead of
+   interning unknown names */
+VFormatAtom  vformat_atom_peek    (const char *name);
+
+/* the canonical, upper case name of @atom.  never freed. */
+const char  *vformat_atom_to_string (VFormatAtom atom);
+
+#endif /* _VFORMAT_ATOMS_H */
@@ -0,0 +1,414 @@
+/* generated by mkatoms.py from vformat_atoms.list, do not edit */
+
+#ifndef VFORMAT_ATOMS_GEN_H
+#define VFORMAT_ATOMS_GEN_H
+
+typedef enum {
+	VF_ATOM_UNKNOWN = 0,
+	VF_ATOM_BEGIN,
+	VF_ATOM_END,
+	VF_ATOM_VERSION,
+	VF_ATOM_SOURCE,
+	VF_ATOM_NAME,
+	VF_ATOM_PROFILE,
+	VF_ATOM_FN,
+	VF_ATOM_N,
+	VF_ATOM_NICKNAME,
+	VF_ATOM_PHOTO,
+	VF_ATOM_BDAY,
+	VF_ATOM_ADR,
+	VF_ATOM_LABEL,
+	VF_ATOM_TEL,
+	VF_ATOM_EMAIL,
+	VF_ATOM_MAILER,
+	VF_ATOM_TZ,
+	VF_ATOM_GEO,
+	VF_ATOM_TITLE,
+	VF_ATOM_ROLE,
+	VF_ATOM_LOGO,
+	VF_ATOM_AGENT,
+	VF_ATOM_ORG,
+	VF_ATOM_CATEGORIES,
+	VF_ATOM_NOTE,
+	VF_ATOM_PRODID,
+	VF_ATOM_REV,
+	VF_ATOM_SORT_STRING,
+	VF_ATOM_SOUND,
+	VF_ATOM_UID,
+	VF_ATOM_URL,
+	VF_ATOM_CLASS,
+	VF_ATOM_KEY,
+	VF_ATOM_TYPE,
+	VF_ATOM_ENCODING,
+	VF_ATOM_CHARSET,
+	VF_ATOM_LANGUAGE,
+	VF_ATOM_VALUE,
+	VF_ATOM_CONTEXT,
+	VF_ATOM_CALSCALE,
+	VF_ATOM_METHOD,
+	VF_ATOM_ATTACH,
+	VF_ATOM_COMMENT,
+	VF_ATOM_DESCRIPTION,
+	VF_ATOM_LOCATION,
+	VF_ATOM_PERCENT_COMPLETE,
+	VF_ATOM_PRIORITY,
+	VF_ATOM_RESOURCES,
+	VF_ATOM_STATUS,
+	VF_ATOM_SUMMARY,
+	VF_ATOM_COMPLETED,
+	VF_ATOM_DTEND,
+	VF_ATOM_DUE,
+	VF_ATOM_DTSTART,
+	VF_ATOM_DURATION,
+	VF_ATOM_FREEBUSY,
+	VF_ATOM_TRANSP,
+	VF_ATOM_TZID,
+	VF_ATOM_TZNAME,
+	VF_ATOM_TZOFFSETFROM,
+	VF_ATOM_TZOFFSETTO,
+	VF_ATOM_TZURL,
+	VF_ATOM_ATTENDEE,
+	VF_ATOM_CONTACT,
+	VF_ATOM_ORGANIZER,
+	VF_ATOM_RECURRENCE_ID,
+	VF_ATOM_RELATED_TO,
+	VF_ATOM_EXDATE,
+	VF_ATOM_EXRULE,
+	VF_ATOM_RDATE,
+	VF_ATOM_RRULE,
+	VF_ATOM_ACTION,
+	VF_ATOM_REPEAT,
+	VF_ATOM_TRIGGER,
+	VF_ATOM_CREATED,
+	VF_ATOM_DTSTAMP,
+	VF_ATOM_LAST_MODIFIED,
+	VF_ATOM_SEQUENCE,
+	VF_ATOM_REQUEST_STATUS,
+	VF_ATOM_ALTREP,
+	VF_ATOM_CN,
+	VF_ATOM_CUTYPE,
+	VF_ATOM_DELEGATED_FROM,
+	VF_ATOM_DELEGATED_TO,
+	VF_ATOM_DIR,
+	VF_ATOM_FMTTYPE,
+	VF_ATOM_FBTYPE,
+	VF_ATOM_MEMBER,
+	VF_ATOM_PARTSTAT,
+	VF_ATOM_RANGE,
+	VF_ATOM_RELATED,
+	VF_ATOM_RELTYPE,
+	VF_ATOM_RSVP,
+	VF_ATOM_SENT_BY,
+	VF_ATOM_VCARD,
+	VF_ATOM_VCALENDAR,
+	VF_ATOM_VEVENT,
+	VF_ATOM_VTODO,
+	VF_ATOM_VJOURNAL,
+	VF_ATOM_VNOTE,
+	VF_ATOM_VTIMEZONE,
+	VF_ATOM_VALARM,
+	VF_ATOM_VFREEBUSY,
+	VF_ATOM_STANDARD,
+	VF_ATOM_DAYLIGHT,
+	VF_ATOM_INTERNET,
+	VF_ATOM_HOME,
+	VF_ATOM_WORK,
+	VF_ATOM_CELL,
+	VF_ATOM_VOICE,
+	VF_ATOM_FAX,
+	VF_ATOM_PREF,
+	VF_ATOM_MSG,
+	VF_ATOM_PAGER,
+	VF_ATOM_BBS,
+	VF_ATOM_MODEM,
+	VF_ATOM_CAR,
+	VF_ATOM_ISDN,
+	VF_ATOM_VIDEO,
+	VF_ATOM_PCS,
+	VF_ATOM_DOM,
+	VF_ATOM_INTL,
+	VF_ATOM_POSTAL,
+	VF_ATOM_PARCEL,
+	VF_ATOM_X400,
+	VF_ATOM_X_CLAWS_ATTRIBUTE,
+	VF_ATOM_N_KNOWN
+} VFormatAtom;
+
+#endif /* VFORMAT_ATOMS_GEN_H */
+
+#ifdef VFORMAT_ATOMS_TABLE
+
+#define VF_ATOM_HASH_SEED  0x811c9dc5U
+#define VF_ATOM_TABLE_SIZE 256
+#define VF_ATOM_N_DISPLACE 64
+
+static const guint8 vformat_atom_displace[VF_ATOM_N_DISPLACE] = {
+	0, 0, 2, 0, 0, 2, 0, 0, 0, 2, 0, 0, 0, 1, 2, 0,
+	0, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 2,
+	1, 3, 0, 7, 3, 0, 1, 0, 0, 3, 0, 1, 0, 2, 0, 1,
+	0, 2, 3, 0, 0, 0, 3, 6, 0, 1, 0, 0, 1, 0, 2, 1,
+};
+
+static const struct {
+	const char *name;
+	VFormatAtom atom;
+} vformat_atom_table[VF_ATOM_TABLE_SIZE] = {
+	[1] = { "CAR", VF_ATOM_CAR },
+	[3] = { "RRULE", VF_ATOM_RRULE },
+	[10] = { "DTEND", VF_ATOM_DTEND },
+	[11] = { "END", VF_ATOM_END },
+	[13] = { "DURATION", VF_ATOM_DURATION },
+	[14] = { "NICKNAME", VF_ATOM_NICKNAME },
+	[16] = { "FAX", VF_ATOM_FAX },
+	[17] = { "PARCEL", VF_ATOM_PARCEL },
+	[18] = { "FMTTYPE", VF_ATOM_FMTTYPE },
+	[19] = { "TZOFFSETTO", VF_ATOM_TZOFFSETTO },
+	[26] = { "ROLE", VF_ATOM_ROLE },
+	[28] = { "CONTEXT", VF_ATOM_CONTEXT },
+	[29] = { "EXDATE", VF_ATOM_EXDATE },
+	[31] = { "BDAY", VF_ATOM_BDAY },
+	[36] = { "DTSTAMP", VF_ATOM_DTSTAMP },
+	[39] = { "NAME", VF_ATOM_NAME },
+	[40] = { "TZOFFSETFROM", VF_ATOM_TZOFFSETFROM },
+	[41] = { "X-CLAWS-ATTRIBUTE", VF_ATOM_X_CLAWS_ATTRIBUTE },
+	[42] = { "VALUE", VF_ATOM_VALUE },
+	[43] = { "RELATED-TO", VF_ATOM_RELATED_TO },
+	[44] = { "CHARSET", VF_ATOM_CHARSET },
+	[45] = { "CUTYPE", VF_ATOM_CUTYPE },
+	[47] = { "RDATE", VF_ATOM_RDATE },
+	[49] = { "X400", VF_ATOM_X400 },
+	[50] = { "METHOD", VF_ATOM_METHOD },
+	[52] = { "SUMMARY", VF_ATOM_SUMMARY },
+	[54] = { "VJOURNAL", VF_ATOM_VJOURNAL },
+	[55] = { "ISDN", VF_ATOM_ISDN },
+	[61] = { "NOTE", VF_ATOM_NOTE },
+	[62] = { "URL", VF_ATOM_URL },
+	[63] = { "SENT-BY", VF_ATOM_SENT_BY },
+	[64] = { "TZNAME", VF_ATOM_TZNAME },
+	[65] = { "DTSTART", VF_ATOM_DTSTART },
+	[66] = { "VTODO", VF_ATOM_VTODO },
+	[67] = { "CONTACT", VF_ATOM_CONTACT },
+	[68] = { "ATTACH", VF_ATOM_ATTACH },
+	[70] = { "AGENT", VF_ATOM_AGENT },
+	[78] = { "HOME", VF_ATOM_HOME },
+	[82] = { "RESOURCES", VF_ATOM_RESOURCES },
+	[83] = { "VCALENDAR", VF_ATOM_VCALENDAR },
+	[85] = { "DUE", VF_ATOM_DUE },
+	[86] = { "TZID", VF_ATOM_TZID },
+	[87] = { "FN", VF_ATOM_FN },
+	[88] = { "PCS", VF_ATOM_PCS },
+	[90] = { "LOGO", VF_ATOM_LOGO },
+	[91] = { "TZ", VF_ATOM_TZ },
+	[95] = { "BEGIN", VF_ATOM_BEGIN },
+	[98] = { "MSG", VF_ATOM_MSG },
+	[101] = { "DELEGATED-TO", VF_ATOM_DELEGATED_TO },
+	[102] = { "FREEBUSY", VF_ATOM_FREEBUSY },
+	[105] = { "LOCATION", VF_ATOM_LOCATION },
+	[111] = { "STATUS", VF_ATOM_STATUS },
+	[117] = { "COMPLETED", VF_ATOM_COMPLETED },
+	[121] = { "ORG", VF_ATOM_ORG },
+	[122] = { "VFREEBUSY", VF_ATOM_VFREEBUSY },
+	[123] = { "PRODID", VF_ATOM_PRODID },
+	[124] = { "RELTYPE", VF_ATOM_RELTYPE },
+	[125] = { "INTERNET", VF_ATOM_INTERNET },
+	[126] = { "COMMENT", VF_ATOM_COMMENT },
+	[127] = { "ADR", VF_ATOM_ADR },
+	[139] = { "STANDARD", VF_ATOM_STANDARD },
+	[141] = { "MODEM", VF_ATOM_MODEM },
+	[142] = { "TYPE", VF_ATOM_TYPE },
+	[143] = { "TZURL", VF_ATOM_TZURL },
+	[150] = { "SORT-STRING", VF_ATOM_SORT_STRING },
+	[151] = { "ALTREP", VF_ATOM_ALTREP },
+	[152] = { "REQUEST-STATUS", VF_ATOM_REQUEST_STATUS },
+	[153] = { "SOURCE", VF_ATOM_SOURCE },
+	[154] = { "TEL", VF_ATOM_TEL },
+	[155] = { "MAILER", VF_ATOM_MAILER },
+	[156] = { "VOICE", VF_ATOM_VOICE },
+	[157] = { "EXRULE", VF_ATOM_EXRULE },
+	[160] = { "WORK", VF_ATOM_WORK },
+	[162] = { "BBS", VF_ATOM_BBS },
+	[163] = { "VEVENT", VF_ATOM_VEVENT },
+	[164] = { "GEO", VF_ATOM_GEO },
+	[167] = { "EMAIL", VF_ATOM_EMAIL },
+	[169] = { "DAYLIGHT", VF_ATOM_DAYLIGHT },
+	[171] = { "LAST-MODIFIED", VF_ATOM_LAST_MODIFIED },
+	[175] = { "UID", VF_ATOM_UID },
+	[178] = { "RANGE", VF_ATOM_RANGE },
+	[179] = { "ATTENDEE", VF_ATOM_ATTENDEE },
+	[180] = { "DIR", VF_ATOM_DIR },
+	[183] = { "VERSION", VF_ATOM_VERSION },
+	[184] = { "INTL", VF_ATOM_INTL },
+	[187] = { "LANGUAGE", VF_ATOM_LANGUAGE },
+	[192] = { "PREF", VF_ATOM_PREF },
+	[193] = { "ACTION", VF_ATOM_ACTION },
+	[195] = { "PHOTO", VF_ATOM_PHOTO },
+	[196] = { "MEMBER", VF_ATOM_MEMBER },
+	[198] = { "VALARM", VF_ATOM_VALARM },
+	[201] = { "DESCRIPTION", VF_ATOM_DESCRIPTION },
+	[202] = { "PRIORITY", VF_ATOM_PRIORITY },
+	[204] = { "KEY", VF_ATOM_KEY },
+	[205] = { "RECURRENCE-ID", VF_ATOM_RECURRENCE_ID },
+	[206] = { "PROFILE", VF_ATOM_PROFILE },
+	[207] = { "VIDEO", VF_ATOM_VIDEO },
+	[209] = { "N", VF_ATOM_N },
+	[212] = { "RSVP", VF_ATOM_RSVP },
+	[217] = { "RELATED", VF_ATOM_RELATED },
+	[218] = { "POSTAL", VF_ATOM_POSTAL },
+	[220] = { "CREATED", VF_ATOM_CREATED },
+	[221] = { "DOM", VF_ATOM_DOM },
+	[222] = { "LABEL", VF_ATOM_LABEL },
+	[223] = { "CLASS", VF_ATOM_CLASS },
+	[226] = { "VNOTE", VF_ATOM_VNOTE },
+	[227] = { "TRIGGER", VF_ATOM_TRIGGER },
+	[230] = { "VTIMEZONE", VF_ATOM_VTIMEZONE },
+	[232] = { "SEQUENCE", VF_ATOM_SEQUENCE },
+	[233] = { "TITLE", VF_ATOM_TITLE },
+	[234] = { "REPEAT", VF_ATOM_REPEAT },
+	[235] = { "FBTYPE", VF_ATOM_FBTYPE },
+	[236] = { "VCARD", VF_ATOM_VCARD },
+	[237] = { "PAGER", VF_ATOM_PAGER },
+	[239] = { "CATEGORIES", VF_ATOM_CATEGORIES },
+	[240] = { "ENCODING", VF_ATOM_ENCODING },
+	[242] = { "REV", VF_ATOM_REV },
+	[243] = { "TRANSP", VF_ATOM_TRANSP },
+	[244] = { "CN", VF_ATOM_CN },
+	[245] = { "DELEGATED-FROM", VF_ATOM_DELEGATED_FROM },
+	[246] = { "CELL", VF_ATOM_CELL },
+	[247] = { "SOUND", VF_ATOM_SOUND },
+	[248] = { "PERCENT-COMPLETE", VF_ATOM_PERCENT_COMPLETE },
+	[249] = { "PARTSTAT", VF_ATOM_PARTSTAT },
+	[250] = { "ORGANIZER", VF_ATOM_ORGANIZER },
+	[255] = { "CALSCALE", VF_ATOM_CALSCALE },
+};
+
+static const char *const vformat_atom_names[VF_ATOM_N_KNOWN] = {
+	NULL,
+	"BEGIN",
+	"END",
+	"VERSION",
+	"SOURCE",
+	"NAME",
+	"PROFILE",
+	"FN",
+	"N",
+	"NICKNAME",
+	"PHOTO",
+	"BDAY",
+	"ADR",
+	"LABEL",
+	"TEL",
+	"EMAIL",
+	"MAILER",
+	"TZ",
+	"GEO",
+	"TITLE",
+	"ROLE",
+	"LOGO",
+	"AGENT",
+	"ORG",
+	"CATEGORIES",
+	"NOTE",
+	"PRODID",
+	"REV",
+	"SORT-STRING",
+	"SOUND",
+	"UID",
+	"URL",
+	"CLASS",
+	"KEY",
+	"TYPE",
+	"ENCODING",
+	"CHARSET",
+	"LANGUAGE",
+	"VALUE",
+	"CONTEXT",
+	"CALSCALE",
+	"METHOD",
+	"ATTACH",
+	"COMMENT",
+	"DESCRIPTION",
+	"LOCATION",
+	"PERCENT-COMPLETE",
+	"PRIORITY",
+	"RESOURCES",
+	"STATUS",
+	"SUMMARY",
+	"COMPLETED",
+	"DTEND",
+	"DUE",
+	"DTSTART",
+	"DURATION",
+	"FREEBUSY",
+	"TRANSP",
+	"TZID",
+	"TZNAME",
+	"TZOFFSETFROM",
+	"TZOFFSETTO",
+	"TZURL",
+	"ATTENDEE",
+	"CONTACT",
+	"ORGANIZER",
+	"RECURRENCE-ID",
+	"RELATED-TO",
+	"EXDATE",
+	"EXRULE",
+	"RDATE",
+	"RRULE",
+	"ACTION",
+	"REPEAT",
+	"TRIGGER",
+	"CREATED",
+	"DTSTAMP",
+	"LAST-MODIFIED",
+	"SEQUENCE",
+	"REQUEST-STATUS",
+	"ALTREP",
+	"CN",
+	"CUTYPE",
+	"DELEGATED-FROM",
+	"DELEGATED-TO",
+	"DIR",
+	"FMTTYPE",
+	"FBTYPE",
+	"MEMBER",
+	"PARTSTAT",
+	"RANGE",
+	"RELATED",
+	"RELTYPE",
+	"RSVP",
+	"SENT-BY",
+	"VCARD",
+	"VCALENDAR",
+	"VEVENT",
+	"VTODO",
+	"VJOURNAL",
+	"VNOTE",
+	"VTIMEZONE",
+	"VALARM",
+	"VFREEBUSY",
+	"STANDARD",
+	"DAYLIGHT",
+	"INTERNET",
+	"HOME",
+	"WORK",
+	"CELL",
+	"VOICE",
+	"FAX",
+	"PREF",
+	"MSG",
+	"PAGER",
+	"BBS",
+	"MODEM",
+	"CAR",
+	"ISDN",
+	"VIDEO",
+	"PCS",
+	"DOM",
+	"INTL",
+	"POSTAL",
+	"PARCEL",
+	"X400",
+	"X-CLAWS-ATTRIBUTE",
+};
+
+#endif /* VFORMAT_ATOMS_TABLE */
@@ -0,0 +1,535 @@
+/*
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include "vformat_codec.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define VFORMAT_CODEC_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const char base64_alphabet[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* reverse of base64_alphabet, 0xff for characters outside of it.  '='
+   ranks 0 so padding decodes as zero bits. */
+static const guchar base64_rank[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* the portable loops, also used for the tails the vector code leaves */
+
+static gsize base64_encode_scalar (const guchar *in, gsize len, char *out)
+{
+	char *o = out;
+
+	for (; len >= 3; len -= 3, in += 3) {
+		*o++ = base64_alphabet[in[0] >> 2];
+		*o++ = base64_alphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+		*o++ = base64_alphabet[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+		*o++ = base64_alphabet[in[2] & 0x3f];
+	}
+	if (len) {
+		*o++ = base64_alphabet[in[0] >> 2];
+		if (len == 2) {
+			*o++ = base64_alphabet[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+			*o++ = base64_alphabet[(in[1] & 0x0f) << 2];
+		}
+		else {
+			*o++ = base64_alphabet[(in[0] & 0x03) << 4];
+			*o++ = '=';
+		}
+		*o++ = '=';
+	}
+
+	return o - out;
+}
+
+/* decodes until the input is used up, or until at least one character
+   is consumed and the next character starts a new quad.  *@state is
+   the number of characters in *@save. */
+static gsize base64_decode_scalar (const guchar **in, const guchar *end, guchar *out,
+                                   guint *state, guint32 *save, gboolean to_end)
+{
+	const guchar *p = *in;
+	guchar *o = out;
+	guint32 v = *save;
+	guint i = *state;
+
+	while (p < end) {
+		guchar c = base64_rank[*p++];
+
+		if (c == 0xff)
+			continue;
+		v = (v << 6) | c;
+		if (++i == 4) {
+			*o++ = v >> 16;
+			*o++ = v >> 8;
+			*o++ = v;
+			i = 0;
+			if (!to_end)
+				break;
+		}
+	}
+
+	*in = p;
+	*save = v;
+	*state = i;
+
+	return o - out;
+}
+
+#ifdef VFORMAT_CODEC_X86
+
+/* The vector code follows the well known approach of Wojciech Mula
+   and Alfred Klomp: the characters are translated with nibble indexed
+   shuffles, validated on the way, and the 6 bit groups are merged with
+   multiply-add instructions. */
+
+__attribute__((target("ssse3")))
+static gsize base64_encode_ssse3 (const guchar *in, gsize len, char *out)
+{
+	const __m128i shuf = _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m128i lut = _mm_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+	                                   -4, -4, -4, -4, -19, -16, 0, 0);
+	gsize done = 0;
+
+	/* 12 bytes per round, but 16 are loaded */
+	while (len - done >= 16) {
+		__m128i s = _mm_loadu_si128 ((const __m128i *)(in + done));
+		__m128i t0, t1, t2, t3, idx, mask;
+
+		s = _mm_shuffle_epi8 (s, shuf);
+		t0 = _mm_and_si128 (s, _mm_set1_epi32 (0x0fc0fc00));
+		t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+		t2 = _mm_and_si128 (s, _mm_set1_epi32 (0x003f03f0));
+		t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+		s = _mm_or_si128 (t1, t3);
+
+		idx = _mm_subs_epu8 (s, _mm_set1_epi8 (51));
+		mask = _mm_cmpgt_epi8 (s, _mm_set1_epi8 (25));
+		idx = _mm_sub_epi8 (idx, mask);
+		s = _mm_add_epi8 (s, _mm_shuffle_epi8 (lut, idx));
+
+		_mm_storeu_si128 ((__m128i *)(out + done / 3 * 4), s);
+		done += 12;
+	}
+
+	return done / 3 * 4 + base64_encode_scalar (in + done, len - done, out + done / 3 * 4);
+}
+
+__attribute__((target("avx2")))
+static gsize base64_encode_avx2 (const guchar *in, gsize len, char *out)
+{
+	const __m256i shuf = _mm256_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+	                                      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m256i lut = _mm256_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+	                                      -4, -4, -4, -4, -19, -16, 0, 0,
+	                                      65, 71, -4, -4, -4, -4, -4, -4,
+	                                      -4, -4, -4, -4, -19, -16, 0, 0);
+	gsize done = 0;
+
+	/* 24 bytes per round, two 12 byte groups in the two lanes */
+	while (len - done >= 28) {
+		__m256i s, t0, t1, t2, t3, idx, mask;
+
+		s = _mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)(in + done)));
+		s = _mm256_inserti128_si256 (s, _mm_loadu_si128 ((const __m128i *)(in + done + 12)), 1);
+
+		s = _mm256_shuffle_epi8 (s, shuf);
+		t0 = _mm256_and_si256 (s, _mm256_set1_epi32 (0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+		t2 = _mm256_and_si256 (s, _mm256_set1_epi32 (0x003f03f0));
+		t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+		s = _mm256_or_si256 (t1, t3);
+
+		idx = _mm256_subs_epu8 (s, _mm256_set1_epi8 (51));
+		mask = _mm256_cmpgt_epi8 (s, _mm256_set1_epi8 (25));
+		idx = _mm256_sub_epi8 (idx, mask);
+		s = _mm256_add_epi8 (s, _mm256_shuffle_epi8 (lut, idx));
+
+		_mm256_storeu_si256 ((__m256i *)(out + done / 3 * 4), s);
+		done += 24;
+	}
+
+	return done / 3 * 4 + base64_encode_ssse3 (in + done, len - done, out + done / 3 * 4);
+}
+
+/* Both decoders stop at the first block holding anything but the 64
+   alphabet characters (padding, whitespace) and return the number of
+   characters consumed, always whole quads.  They store more bytes than
+   they produce, so they only run while that stays within what the
+   remaining input decodes to.  The stores never overtake the loads,
+   which keeps decoding in place safe. */
+
+__attribute__((target("ssse3")))
+static gsize base64_decode_ssse3 (const guchar *in, gsize len, guchar *out)
+{
+	const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                                      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	                                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+	                                        0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+	const __m128i pack = _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	gsize done = 0;
+
+	while (len - done >= 24) {
+		__m128i s = _mm_loadu_si128 ((const __m128i *)(in + done));
+		__m128i hi_nibbles, lo_nibbles, hi, lo, roll;
+
+		hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (s, 4), mask_2f);
+		lo_nibbles = _mm_and_si128 (s, mask_2f);
+		hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+		lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+		if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi), _mm_setzero_si128 ())))
+			break;
+
+		roll = _mm_shuffle_epi8 (lut_roll, _mm_add_epi8 (_mm_cmpeq_epi8 (s, mask_2f), hi_nibbles));
+		s = _mm_add_epi8 (s, roll);
+
+		s = _mm_maddubs_epi16 (s, _mm_set1_epi32 (0x01400140));
+		s = _mm_madd_epi16 (s, _mm_set1_epi32 (0x00011000));
+		s = _mm_shuffle_epi8 (s, pack);
+
+		_mm_storeu_si128 ((__m128i *)(out + done / 4 * 3), s);
+		done += 16;
+	}
+
+	return done;
+}
+
+__attribute__((target("avx2")))
+static gsize base64_decode_avx2 (const guchar *in, gsize len, guchar *out)
+{
+	const __m256i lut_lo = _mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+	                                         0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                                         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+	                                         0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+	                                           0, 0, 0, 0, 0, 0, 0, 0,
+	                                           0, 16, 19, 4, -65, -65, -71, -71,
+	                                           0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+	const __m256i pack = _mm256_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+	                                       2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i join = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 7, 7);
+	gsize done = 0;
+
+	while (len - done >= 48) {
+		__m256i s = _mm256_loadu_si256 ((const __m256i *)(in + done));
+		__m256i hi_nibbles, lo_nibbles, hi, lo, roll;
+
+		hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (s, 4), mask_2f);
+		lo_nibbles = _mm256_and_si256 (s, mask_2f);
+		hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+		lo = _mm256_shuffle_epi8 (lut_lo, lo_nibbles);
+		if (!_mm256_testz_si256 (lo, hi))
+			break;
+
+		roll = _mm256_shuffle_epi8 (lut_roll, _mm256_add_epi8 (_mm256_cmpeq_epi8 (s, mask_2f), hi_nibbles));
+		s = _mm256_add_epi8 (s, roll);
+
+		s = _mm256_maddubs_epi16 (s, _mm256_set1_epi32 (0x01400140));
+		s = _mm256_madd_epi16 (s, _mm256_set1_epi32 (0x00011000));
+		s = _mm256_shuffle_epi8 (s, pack);
+		s = _mm256_permutevar8x32_epi32 (s, join);
+
+		_mm256_storeu_si256 ((__m256i *)(out + done / 4 * 3), s);
+		done += 32;
+	}
+
+	return done + base64_decode_ssse3 (in + done, len - done, out + done / 4 * 3);
+}
+
+#endif /* VFORMAT_CODEC_X86 */
+
+gsize vformat_base64_encode (const guchar *in, gsize len, char *out)
+{
+#ifdef VFORMAT_CODEC_X86
+	if (__builtin_cpu_supports ("avx2"))
+		return base64_encode_avx2 (in, len, out);
+	if (__builtin_cpu_supports ("ssse3"))
+		return base64_encode_ssse3 (in, len, out);
+#endif
+	return base64_encode_scalar (in, len, out);
+}
+
+gsize vformat_base64_decode (const char *in, gsize len, guchar *out)
+{
+	const guchar *p = (const guchar *)in;
+	const guchar *end = p + len;
+	guchar *o = out;
+	guint state = 0;
+	guint32 save = 0;
+	guint pad = 0, seen = 0;
+#ifdef VFORMAT_CODEC_X86
+	gsize (*decode_block) (const guchar *, gsize, guchar *) = NULL;
+
+	if (__builtin_cpu_supports ("avx2"))
+		decode_block = base64_decode_avx2;
+	else if (__builtin_cpu_supports ("ssse3"))
+		decode_block = base64_decode_ssse3;
+#endif
+
+	/* each trailing '=' (up to 2) drops one output byte.  Counted
+	   before decoding, an in place decode overwrites them. */
+	while (end > p && seen < 2) {
+		end--;
+		if (base64_rank[*end] != 0xff) {
+			if (*end == '=')
+				pad++;
+			seen++;
+		}
+	}
+	end = p + len;
+
+	while (p < end) {
+#ifdef VFORMAT_CODEC_X86
+		/* the vector code only runs on quad boundaries.  Whatever
+		   stops it is stepped over by the scalar code, which hands
+		   back at the start of the next quad. */
+		if (decode_block && !state) {
+			gsize n = decode_block (p, end - p, o);
+			p += n;
+			o += n / 4 * 3;
+		}
+		o += base64_decode_scalar (&p, end, o, &state, &save, FALSE);
+#else
+		o += base64_decode_scalar (&p, end, o, &state, &save, TRUE);
+#endif
+	}
+
+	return (gsize)(o - out) > pad ? (gsize)(o - out) - pad : 0;
+}
+
+#ifdef VFORMAT_CODEC_X86
+__attribute__((target("avx2")))
+static gsize scan_until_avx2 (const char *s, gsize len, const char *stop, guint n_stop)
+{
+	__m256i set[8];
+	gsize i = 0;
+	guint k;
+
+	for (k = 0; k < n_stop; k++)
+		set[k] = _mm256_set1_epi8 (stop[k]);
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256 ((const __m256i *)(s + i));
+		__m256i hit = _mm256_cmpeq_epi8 (block, set[0]);
+		guint mask;
+
+		for (k = 1; k < n_stop; k++)
+			hit = _mm256_or_si256 (hit, _mm256_cmpeq_epi8 (block, set[k]));
+		mask = _mm256_movemask_epi8 (hit);
+		if (mask)
+			return i + __builtin_ctz (mask);
+	}
+
+	return i;
+}
+#endif
+
+gsize vformat_scan_until (const char *s, gsize len, const char *stop, guint n_stop)
+{
+	gsize i = 0;
+	guint k;
+
+#ifdef VFORMAT_CODEC_X86
+	/* only worth it for long runs, short values stay on SSE2 */
+	if (len >= 64 && n_stop && n_stop <= 8 && __builtin_cpu_supports ("avx2")) {
+		i = scan_until_avx2 (s, len, stop, n_stop);
+		if (i + 32 <= len)
+			return i;
+	}
+#endif
+
+#ifdef __SSE2__
+	if (n_stop && n_stop <= 8) {
+		__m128i set[8];
+
+		for (k = 0; k < n_stop; k++)
+			set[k] = _mm_set1_epi8 (stop[k]);
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i block = _mm_loadu_si128 ((const __m128i *)(s + i));
+			__m128i hit = _mm_cmpeq_epi8 (block, set[0]);
+			int mask;
+
+			for (k = 1; k < n_stop; k++)
+				hit = _mm_or_si128 (hit, _mm_cmpeq_epi8 (block, set[k]));
+			mask = _mm_movemask_epi8 (hit);
+			if (mask)
+				return i + __builtin_ctz (mask);
+		}
+	}
+#endif
+
+	for (; i < len; i++) {
+		for (k = 0; k < n_stop; k++) {
+			if (s[i] == stop[k])
+				return i;
+		}
+	}
+
+	return len;
+}
+
+/* the bytes vformat_qp_encode() escapes */
+#define QP_NEEDS_ESCAPE(c) ((c) > 127 || (c) == '\r' || (c) == '\n' || (c) == '=')
+
+/* length of the initial run of @in that is copied unchanged */
+static gsize qp_literal_run (const guchar *in, gsize len)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	const __m128i eq = _mm_set1_epi8 ('=');
+	const __m128i cr = _mm_set1_epi8 ('\r');
+	const __m128i lf = _mm_set1_epi8 ('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128 ((const __m128i *)(in + i));
+		/* the sign bit of the block itself flags the bytes above 127 */
+		__m128i hit = _mm_or_si128 (block, _mm_cmpeq_epi8 (block, eq));
+		int mask;
+
+		hit = _mm_or_si128 (hit, _mm_cmpeq_epi8 (block, cr));
+		hit = _mm_or_si128 (hit, _mm_cmpeq_epi8 (block, lf));
+		mask = _mm_movemask_epi8 (hit);
+		if (mask)
+			return i + __builtin_ctz (mask);
+	}
+#endif
+
+	while (i < len && !QP_NEEDS_ESCAPE (in[i]))
+		i++;
+
+	return i;
+}
+
+gsize vformat_qp_encode (const guchar *in, gsize len, char *out)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char *o = out;
+	gsize i = 0;
+
+	while (i < len) {
+		gsize run = qp_literal_run (in + i, len - i);
+
+		memcpy (o, in + i, run);
+		o += run;
+		i += run;
+
+		for (; i < len && QP_NEEDS_ESCAPE (in[i]); i++) {
+			*o++ = '=';
+			*o++ = hex[in[i] >> 4];
+			*o++ = hex[in[i] & 0x0f];
+		}
+	}
+
+	return o - out;
+}
+
+static gint qp_hex_value (guchar c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+gsize vformat_qp_decode (const char *in, gsize len, guchar *out)
+{
+	const char *p = in;
+	const char *end = in + len;
+	guchar *o = out;
+
+	while (p < end) {
+		const char *eq = memchr (p, '=', end - p);
+		gsize run = (eq ? eq : end) - p;
+		gint hi, lo;
+
+		/* in place the output is never ahead of the input */
+		if ((const char *)o != p)
+			memmove (o, p, run);
+		o += run;
+		p += run;
+		if (!eq)
+			break;
+
+		p++;
+		if (p < end && *p == '\n') {
+			p++;
+			continue;
+		}
+		if (p < end && *p == '\r') {
+			p++;
+			if (p < end && *p == '\n')
+				p++;
+			continue;
+		}
+		if (p == end)
+			break;
+
+		if (end - p >= 2 &&
+		    (hi = qp_hex_value (p[0])) >= 0 && (lo = qp_hex_value (p[1])) >= 0) {
+			*o++ = (hi << 4) | lo;
+			p += 2;
+		}
+		else
+			*o++ = '=';
+	}
+
+	return o - out;
+}
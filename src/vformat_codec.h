@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+/* Value encodings used by vformat.
+ *
+ * On x86 the base64 codec uses SSSE3 or AVX2 code paths, picked at
+ * runtime from what the CPU supports.  The quoted-printable codec and
+ * the scanners look at 16 bytes at a time where SSE2 is available.
+ * Everything else, and every other architecture, uses the portable
+ * loops. */
+
+#ifndef _VFORMAT_CODEC_H
+#define _VFORMAT_CODEC_H
+
+#include <glib.h>
+
+/* encoded size of @len bytes, without line breaks or terminating NUL */
+#define VFORMAT_BASE64_ENCODED_LEN(len) ((((gsize)(len) + 2) / 3) * 4)
+
+/* upper bound for the decoded size of @len base64 characters */
+#define VFORMAT_BASE64_DECODED_LEN(len) (((gsize)(len) / 4) * 3 + 3)
+
+/* encodes @len bytes of @in to @out, padded with '=' and without line
+   breaks.  @out needs VFORMAT_BASE64_ENCODED_LEN(@len) bytes, no NUL
+   is written.  Returns the number of characters written. */
+gsize vformat_base64_encode (const guchar *in, gsize len, char *out);
+
+/* decodes @len characters of @in to @out.  Characters outside of the
+   base64 alphabet (whitespace, line breaks) are skipped, up to two
+   trailing '=' drop the padding bytes.  @out may be @in, for decoding
+   in place.  Returns the number of bytes written. */
+gsize vformat_base64_decode (const char *in, gsize len, guchar *out);
+
+/* encoded size of @len bytes in the worst case, every byte escaped */
+#define VFORMAT_QP_ENCODED_MAX(len) ((gsize)(len) * 3)
+
+/* quoted-printable encodes @len bytes of @in to @out.  Bytes above 127,
+   CR, LF and '=' are escaped, no soft line breaks are inserted (the
+   serializer folds lines itself).  No NUL is written.  Returns the
+   number of characters written. */
+gsize vformat_qp_encode (const guchar *in, gsize len, char *out);
+
+/* decodes @len characters of quoted-printable @in to @out, dropping
+   soft line breaks.  A '=' that does not start a valid escape is kept
+   as it is.  @out may be @in, for decoding in place.  Returns the
+   number of bytes written. */
+gsize vformat_qp_decode (const char *in, gsize len, guchar *out);
+
+/* length of the initial run of @s (at most @len bytes) holding none of
+   the @n_stop bytes in @stop.  Like strcspn(), but for short sets over
+   long runs, and the data need not be NUL terminated. */
+gsize vformat_scan_until (const char *s, gsize len, const char *stop, guint n_stop);
+
+#endif /* _VFORMAT_CODEC_H */
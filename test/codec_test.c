@@ -0,0 +1,350 @@
+/* Claws-Mail plugin for OpenSync
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks the vector code paths of the value codecs against the portable
+ * loops, run by "make check".  Exits with 1 if any check failed.
+ *
+ * The codec is included rather than linked, to get at its static scalar
+ * and per-instruction-set functions.  The lengths tried cover every
+ * block size the vector loops use, with tails of every length. */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "vformat_codec.c"
+
+#define CHECK(cond) G_STMT_START {                                      \
+	if(!(cond)) {                                                   \
+		g_print("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++;                                             \
+	}                                                               \
+} G_STMT_END
+
+/* longest input tried, well past two AVX2 blocks */
+#define MAX_LEN 200
+
+/* bytes after an output buffer that no function may touch */
+#define GUARD_LEN 32
+#define GUARD_BYTE 0xa5
+
+typedef gsize (*EncodeFunc)(const guchar*, gsize, char*);
+typedef gsize (*DecodeBlockFunc)(const guchar*, gsize, guchar*);
+
+static int failures = 0;
+
+/* the same bytes on every run */
+static guint32 random_state = 1;
+
+static guchar random_byte(void)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return random_state >> 16;
+}
+
+static gboolean guard_intact(const guchar *guard)
+{
+	int i;
+
+	for(i = 0; i < GUARD_LEN; i++) {
+		if(guard[i] != GUARD_BYTE)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* what vformat_base64_decode() does where there is no vector code */
+static gsize scalar_base64_decode(const char *in, gsize len, guchar *out)
+{
+	const guchar *p = (const guchar*)in;
+	const guchar *end = p + len;
+	guint state = 0, pad = 0, seen = 0;
+	guint32 save = 0;
+	gsize n;
+
+	while(end > p && seen < 2) {
+		end--;
+		if(base64_rank[*end] != 0xff) {
+			if(*end == '=')
+				pad++;
+			seen++;
+		}
+	}
+
+	n = base64_decode_scalar(&p, p + len, out, &state, &save, TRUE);
+	return n > pad ? n - pad : 0;
+}
+
+/* @encode must give the scalar encoding.  @decode_block, if set, must
+   decode whatever prefix of an encoded string it takes like the scalar
+   code does, and not write past the decoded size of the whole string. */
+static void test_base64_variant(EncodeFunc encode, DecodeBlockFunc decode_block)
+{
+	guchar in[MAX_LEN];
+	char expected[VFORMAT_BASE64_ENCODED_LEN(MAX_LEN)];
+	char got[VFORMAT_BASE64_ENCODED_LEN(MAX_LEN) + GUARD_LEN];
+	guchar decoded[MAX_LEN + GUARD_LEN];
+	gsize len, i, n, consumed;
+
+	for(len = 0; len <= MAX_LEN; len++) {
+		for(i = 0; i < len; i++)
+			in[i] = random_byte();
+
+		n = base64_encode_scalar(in, len, expected);
+		CHECK(n == VFORMAT_BASE64_ENCODED_LEN(len));
+
+		memset(got, GUARD_BYTE, sizeof(got));
+		CHECK(encode(in, len, got) == n);
+		CHECK(memcmp(got, expected, n) == 0);
+		CHECK(guard_intact((guchar*)got + n));
+
+		if(!decode_block)
+			continue;
+
+		/* the guard starts where the decoded bytes end */
+		memset(decoded, GUARD_BYTE, sizeof(decoded));
+		consumed = decode_block((guchar*)expected, n, decoded + MAX_LEN - len);
+		CHECK(consumed % 4 == 0 && consumed <= n);
+		/* long input has to take the vector path at least once */
+		CHECK(len < 48 || consumed > 0);
+		CHECK(memcmp(decoded + MAX_LEN - len, in, MIN(consumed / 4 * 3, len)) == 0);
+		CHECK(guard_intact(decoded + MAX_LEN));
+	}
+}
+
+/* the public functions, whatever code path they pick, against the
+   scalar decoder: plain and in place, with line breaks, folding
+   whitespace and a stray character at every position */
+static void test_base64_decode(void)
+{
+	guchar in[MAX_LEN];
+	char encoded[VFORMAT_BASE64_ENCODED_LEN(MAX_LEN) + 3];
+	char buf[VFORMAT_BASE64_ENCODED_LEN(MAX_LEN) + 3];
+	guchar expected[VFORMAT_BASE64_DECODED_LEN(sizeof(buf))];
+	guchar got[VFORMAT_BASE64_DECODED_LEN(sizeof(buf))];
+	gsize len, i, pos, n, m;
+	static const char *junk[] = { "\r\n ", "\n\t", "*" };
+	guint j;
+
+	for(len = 0; len <= MAX_LEN; len++) {
+		for(i = 0; i < len; i++)
+			in[i] = random_byte();
+		n = vformat_base64_encode(in, len, encoded);
+
+		CHECK(vformat_base64_decode(encoded, n, got) == len);
+		CHECK(memcmp(got, in, len) == 0);
+
+		memcpy(buf, encoded, n);
+		CHECK(vformat_base64_decode(buf, n, (guchar*)buf) == len);
+		CHECK(memcmp(buf, in, len) == 0);
+
+		if(len > 64)
+			continue;
+		for(j = 0; j < G_N_ELEMENTS(junk); j++) {
+			for(pos = 0; pos <= n; pos++) {
+				gsize junk_len = strlen(junk[j]);
+
+				memcpy(buf, encoded, pos);
+				memcpy(buf + pos, junk[j], junk_len);
+				memcpy(buf + pos + junk_len, encoded + pos, n - pos);
+
+				m = scalar_base64_decode(buf, n + junk_len, expected);
+				CHECK(m == len);
+				CHECK(vformat_base64_decode(buf, n + junk_len, got) == m);
+				CHECK(memcmp(got, expected, m) == 0);
+			}
+		}
+	}
+}
+
+/* a printable run with @special at @pos, if @pos < @len */
+static void fill_text(guchar *buf, gsize len, gsize pos, guchar special)
+{
+	gsize i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = ' ' + random_byte() % 94;
+	if(pos < len)
+		buf[pos] = special;
+}
+
+/* byte by byte, without the bulk copies of literal runs */
+static gsize ref_qp_encode(const guchar *in, gsize len, char *out)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char *o = out;
+	gsize i;
+
+	for(i = 0; i < len; i++) {
+		if(QP_NEEDS_ESCAPE(in[i])) {
+			*o++ = '=';
+			*o++ = hex[in[i] >> 4];
+			*o++ = hex[in[i] & 0x0f];
+		}
+		else
+			*o++ = in[i];
+	}
+	return o - out;
+}
+
+static gsize ref_qp_decode(const char *in, gsize len, guchar *out)
+{
+	guchar *o = out;
+	gsize i = 0;
+
+	while(i < len) {
+		if(in[i] != '=') {
+			*o++ = in[i++];
+			continue;
+		}
+		i++;
+		if(i < len && in[i] == '\n')
+			i++;
+		else if(i < len && in[i] == '\r') {
+			i++;
+			if(i < len && in[i] == '\n')
+				i++;
+		}
+		else if(i + 1 < len && g_ascii_isxdigit(in[i]) && g_ascii_isxdigit(in[i + 1])) {
+			*o++ = (g_ascii_xdigit_value(in[i]) << 4) | g_ascii_xdigit_value(in[i + 1]);
+			i += 2;
+		}
+		else if(i < len)
+			*o++ = '=';
+	}
+	return o - out;
+}
+
+/* the SSE2 literal run scan and the coders built on it, with each byte
+   that ends a run at every position of the first 64, against the byte
+   by byte loops */
+static void test_qp(void)
+{
+	static const guchar specials[] = { '=', '\r', '\n', 0x80, 0xff };
+	guchar in[MAX_LEN];
+	char encoded[VFORMAT_QP_ENCODED_MAX(MAX_LEN)];
+	char expected[VFORMAT_QP_ENCODED_MAX(MAX_LEN)];
+	guchar decoded[MAX_LEN];
+	gsize len, pos, n, run;
+	guint s;
+
+	for(len = 0; len <= MAX_LEN; len++) {
+		for(s = 0; s < G_N_ELEMENTS(specials); s++) {
+			for(pos = 0; pos <= MIN(len, 64); pos++) {
+				fill_text(in, len, pos, specials[s]);
+
+				for(run = 0; run < len && !QP_NEEDS_ESCAPE(in[run]); run++)
+					;
+				CHECK(qp_literal_run(in, len) == run);
+
+				n = vformat_qp_encode(in, len, encoded);
+				CHECK(n == ref_qp_encode(in, len, expected));
+				CHECK(memcmp(encoded, expected, n) == 0);
+
+				CHECK(vformat_qp_decode(encoded, n, decoded) == len);
+				CHECK(memcmp(decoded, in, len) == 0);
+			}
+		}
+	}
+}
+
+/* encoded text the encoder never writes: soft line breaks, lower case
+   and broken escapes and a '=' at the very end, plain and in place */
+static void test_qp_decode(void)
+{
+	static const char *pieces[] = {
+		"=\r\n", "=\n", "=\r", "=3D", "=c3=bc", "=G1", "=4", "=", "==41"
+	};
+	char in[MAX_LEN + 8];
+	char buf[MAX_LEN + 8];
+	guchar expected[MAX_LEN + 8], got[MAX_LEN + 8];
+	gsize len, pos, n, m;
+	guint p;
+
+	for(len = 0; len <= MAX_LEN; len += (len < 64) ? 1 : 17) {
+		for(p = 0; p < G_N_ELEMENTS(pieces); p++) {
+			gsize piece_len = strlen(pieces[p]);
+
+			for(pos = 0; pos <= len; pos += (len < 64) ? 1 : 13) {
+				fill_text((guchar*)in, len, len, 0);
+				for(n = 0; n < len; n++) {
+					if(in[n] == '=')
+						in[n] = '-';
+				}
+				memmove(in + pos + piece_len, in + pos, len - pos);
+				memcpy(in + pos, pieces[p], piece_len);
+				n = len + piece_len;
+
+				m = ref_qp_decode(in, n, expected);
+				CHECK(vformat_qp_decode(in, n, got) == m);
+				CHECK(memcmp(got, expected, m) == 0);
+
+				memcpy(buf, in, n);
+				CHECK(vformat_qp_decode(buf, n, (guchar*)buf) == m);
+				CHECK(memcmp(buf, expected, m) == 0);
+			}
+		}
+	}
+}
+
+/* the AVX2 and SSE2 scans against strcspn() style scanning, for stop
+   sets of one to eight bytes and one that is too large for them */
+static void test_scan_until(void)
+{
+	static const char stop[] = ";,\\\r\n:=\"\t";
+	guchar in[MAX_LEN];
+	gsize len, pos, i, expected;
+	guint n_stop;
+
+	for(n_stop = 1; n_stop < sizeof(stop); n_stop++) {
+		for(len = 0; len <= MAX_LEN; len++) {
+			for(pos = 0; pos <= len; pos++) {
+				fill_text(in, len, pos, stop[random_byte() % n_stop]);
+				for(i = 0; i < len; i++) {
+					if(i != pos && memchr(stop, in[i], n_stop))
+						in[i] = 'x';
+				}
+
+				expected = len;
+				for(i = 0; i < len && expected == len; i++) {
+					if(memchr(stop, in[i], n_stop))
+						expected = i;
+				}
+				CHECK(vformat_scan_until((char*)in, len, stop, n_stop) == expected);
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	test_base64_variant(base64_encode_scalar, NULL);
+#ifdef VFORMAT_CODEC_X86
+	if(__builtin_cpu_supports("ssse3"))
+		test_base64_variant(base64_encode_ssse3, base64_decode_ssse3);
+	if(__builtin_cpu_supports("avx2"))
+		test_base64_variant(base64_encode_avx2, base64_decode_avx2);
+#endif
+	test_base64_decode();
+	test_qp();
+	test_qp_decode();
+	test_scan_until();
+
+	if(failures)
+		g_print("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
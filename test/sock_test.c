@@ -32,10 +32,16 @@ static int      sock_write_all(int, const char*, int);
 static gboolean sock_send(int fd, char *msg);
 static void     sock_eval_answer(int);
 static void     sock_eval_contact(int);
+static gchar*   sock_read_contact(int, const gchar*, gboolean*);
+static gint     sock_eval_contact_list(int, const gchar*, gint*, GSList**);
+static gboolean sock_eval_find(int, const gchar*);
+static void     check(gboolean, const gchar*);
+static void     check_index_requests(int);
 
 static gchar*   answer_check_val(const gchar*,gchar*);
 
 static int uxsock = -1;
+static int failed_checks = 0;
 
 static gchar* answer_check_val(const gchar *prefix, gchar *msg)
 {
@@ -107,6 +113,165 @@ static void sock_eval_contact(int fd)
 	} while(!done);
 }
 
+/* reads the rest of a contact after its :start_contact: line.  Returns
+   its UID, *@found tells if a line of it contains @needle (ignoring
+   case). */
+static gchar* sock_read_contact(int fd, const gchar *needle, gboolean *found)
+{
+	gchar *line;
+	gchar *uid = NULL;
+	gchar *lower_needle;
+
+	lower_needle = g_ascii_strdown(needle, -1);
+	*found = FALSE;
+	while((line = sock_answer_get_next_line(fd)) != NULL) {
+		gchar *lower;
+		if(g_str_has_prefix(line, ":end_contact:"))
+			break;
+		if(g_str_has_prefix(line, "UID:")) {
+			g_free(uid);
+			uid = g_strdup(g_strchomp(line + strlen("UID:")));
+		}
+		lower = g_ascii_strdown(line, -1);
+		if(strstr(lower, lower_needle))
+			*found = TRUE;
+		g_free(lower);
+	}
+	g_free(lower_needle);
+	return uid;
+}
+
+/* reads the answer to :add_contacts: or :search_contacts:.  Returns the
+   number of contacts before :done:, or -1 on :failure:.  *@matching
+   counts the ones that contain @needle, their UIDs are prepended to
+   *@uids if that is given. */
+static gint sock_eval_contact_list(int fd, const gchar *needle, gint *matching, GSList **uids)
+{
+	gchar *line;
+	gint count = 0;
+
+	*matching = 0;
+	while((line = sock_answer_get_next_line(fd)) != NULL) {
+		if(g_str_has_prefix(line, ":done:"))
+			return count;
+		else if(g_str_has_prefix(line, ":failure:"))
+			return -1;
+		else if(g_str_has_prefix(line, ":start_contact:")) {
+			gboolean found;
+			gchar *uid;
+			uid = sock_read_contact(fd, needle, &found);
+			count++;
+			if(found)
+				(*matching)++;
+			if(uids && uid)
+				*uids = g_slist_prepend(*uids, uid);
+			else
+				g_free(uid);
+		}
+	}
+	return -1;
+}
+
+/* reads the answer to :find_contact_by_email:.  TRUE if a contact came
+   that contains @needle. */
+static gboolean sock_eval_find(int fd, const gchar *needle)
+{
+	gchar *line;
+	gboolean found = FALSE;
+
+	line = sock_answer_get_next_line(fd);
+	if(line && g_str_has_prefix(line, ":start_contact:"))
+		g_free(sock_read_contact(fd, needle, &found));
+	return found;
+}
+
+static void check(gboolean ok, const gchar *what)
+{
+	if(ok)
+		g_print("ok: %s\n", what);
+	else {
+		g_print("FAILED: %s\n", what);
+		failed_checks++;
+	}
+}
+
+/* the duplicate, email and search indexes, on two contacts added for
+   this run.  They are deleted again at the end. */
+static void check_index_requests(int fd)
+{
+	GSList *uids = NULL, *again = NULL, *walk;
+	gint n, matching;
+
+	sock_send(fd, ":add_contacts:\n");
+	sock_send(fd, "BEGIN:VCARD\nVERSION:2.1\nN:Indextest;Anna\nFN:Anna Indextest\nEMAIL;INTERNET:anna.indextest@example.org\nEND:VCARD\n");
+	sock_send(fd, "BEGIN:VCARD\nVERSION:2.1\nN:Indextest;Bert\nFN:Bert Indextest 2007\nEMAIL;INTERNET:bert.indextest@example.org\nEND:VCARD\n");
+	sock_send(fd, ":done:\n");
+	n = sock_eval_contact_list(fd, "indextest", &matching, &uids);
+	check(n == 2 && matching == 2, "add_contacts adds both contacts");
+
+	/* found by name and address, the contact is handed back instead */
+	sock_send(fd, ":add_contacts:\n");
+	sock_send(fd, "BEGIN:VCARD\nVERSION:2.1\nN:Indextest;Anna\nFN:Anna Indextest\nEMAIL;INTERNET:anna.indextest@example.org\nEND:VCARD\n");
+	sock_send(fd, ":done:\n");
+	n = sock_eval_contact_list(fd, "anna.indextest@example.org", &matching, &again);
+	check(n == 1 && matching == 1 && again && uids &&
+	      g_slist_find_custom(uids, again->data, (GCompareFunc)strcmp),
+	      "add_contacts hands back a contact that exists");
+	for(walk = again; walk; walk = walk->next)
+		g_free(walk->data);
+	g_slist_free(again);
+
+	sock_send(fd, ":find_contact_by_email: anna.indextest@example.org\n");
+	check(sock_eval_find(fd, "anna.indextest@example.org"), "find_contact_by_email finds a new contact");
+
+	sock_send(fd, ":find_contact_by_email:   Bert.Indextest@EXAMPLE.org  \n");
+	check(sock_eval_find(fd, "bert.indextest@example.org"), "find_contact_by_email ignores case and blanks");
+
+	sock_send(fd, ":find_contact_by_email: nobody.indextest@example.org\n");
+	check(!sock_eval_find(fd, "indextest"), "find_contact_by_email fails for an unknown address");
+
+	sock_send(fd, ":search_contacts: 10 indextest\n");
+	n = sock_eval_contact_list(fd, "indextest", &matching, NULL);
+	check(n >= 2 && matching == n, "search_contacts finds both contacts");
+
+	sock_send(fd, ":search_contacts: 1 indextest\n");
+	n = sock_eval_contact_list(fd, "indextest", &matching, NULL);
+	check(n == 1, "search_contacts keeps to the limit");
+
+	sock_send(fd, ":search_contacts: 10 Bert Indextest 2007\n");
+	n = sock_eval_contact_list(fd, "bert indextest 2007", &matching, NULL);
+	check(n == 1 && matching == 1, "search_contacts takes a text with blanks that ends in a number");
+
+	sock_send(fd, ":search_contacts: 0 ANNA.INDEX\n");
+	n = sock_eval_contact_list(fd, "anna.indextest@example.org", &matching, NULL);
+	check(n >= 1 && matching >= 1, "search_contacts matches email addresses, ignoring case");
+
+	sock_send(fd, ":search_contacts: indextest\n");
+	n = sock_eval_contact_list(fd, "indextest", &matching, NULL);
+	check(n == -1, "search_contacts fails without a limit");
+
+	/* the lookups made them known to this session, so they can be
+	   deleted by UID */
+	for(walk = uids; walk; walk = walk->next) {
+		gchar *msg;
+		gchar *line;
+		msg = g_strdup_printf(":delete_contact:\n%s\n", (gchar*)walk->data);
+		sock_send(fd, msg);
+		g_free(msg);
+		line = sock_answer_get_next_line(fd);
+		check(line && g_str_has_prefix(line, ":ok:"), "delete_contact removes an added contact");
+		g_free(walk->data);
+	}
+	g_slist_free(uids);
+
+	sock_send(fd, ":find_contact_by_email: anna.indextest@example.org\n");
+	check(!sock_eval_find(fd, "indextest"), "find_contact_by_email forgets deleted contacts");
+
+	sock_send(fd, ":search_contacts: 10 indextest\n");
+	n = sock_eval_contact_list(fd, "indextest", &matching, NULL);
+	check(n >= 0 && matching == 0, "search_contacts forgets deleted contacts");
+}
+
 static void sock_eval_answer(int fd)
 {
 	char *line;
@@ -122,6 +287,10 @@ static void sock_eval_answer(int fd)
 				complete = TRUE;
 				g_print("Claws Mail reported success\n");
 			}
+			else if(g_str_has_prefix(line,":unchanged:")) {
+				complete = TRUE;
+				g_print("Claws Mail reported no changes\n");
+			}
 			else if(g_str_has_prefix(line,":failure:")) {
 				complete = TRUE;
 				g_print("Claws Mail reported failure\n");
@@ -209,6 +378,8 @@ int main(void)
 	if(sock_send(uxsock, ":request_contacts:\n"))
 		sock_eval_answer(uxsock);
 
+	check_index_requests(uxsock);
+
 	//	sock_send(uxsock, ":modify_contact:\n");
 	//	sock_send(uxsock, "194022980\n");
 //	sock_send(uxsock, "BEGIN:VCARD\nVERSION:2.1\nN:Mustermann;Hans\nADR;TYPE=home:;;Musterstraße 1;Musterstadt;;12345;Deutschland\nTEL;HOME;VOICE:+49 1234 56788\nTEL;TYPE=CELL:+49 1234 56789\nTEL;HOME;FAX:+49 1234 12345\nEND:VCARD\n");
@@ -237,5 +408,9 @@ int main(void)
 	sock_send(uxsock, ":finished:\n");
 
 	close(uxsock);
+	if(failed_checks) {
+		g_print("%d checks failed\n", failed_checks);
+		return 1;
+	}
 	return 0;
 }
@@ -0,0 +1,429 @@
+/* Claws-Mail plugin for OpenSync
+ * Copyright (C) 2007 Holger Berndt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checks of the vformat parsers and value coding, run by "make check".
+ * Exits with 1 if any check failed. */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "vformat.h"
+#include "vformat_codec.h"
+
+#define CHECK(cond) G_STMT_START {                                      \
+	if(!(cond)) {                                                   \
+		g_print("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++;                                             \
+	}                                                               \
+} G_STMT_END
+
+static int failures = 0;
+
+/* folded lines, a soft line break in a quoted-printable value, an empty
+   line and an unknown property, with CRLF and with plain LF endings */
+static const char *test_cards[] = {
+	"BEGIN:VCARD\r\nVERSION:2.1\r\nN:Mustermann;Hans\r\nFN:Hans Mustermann\r\n"
+	"EMAIL;INTERNET:hans@example.org\r\n"
+	"NOTE;ENCODING=QUOTED-PRINTABLE;CHARSET=UTF-8:N=C3=BCrnberg=\r\n ok=\r\nmore\r\n"
+	"CATEGORIES:a,b\\,c\r\nPHOTO;ENCODING=BASE64;TYPE=JPEG:aGVsbG8gd29y\r\n bGQ=\r\n"
+	"\r\nX-FOO;X-P=1:bar\r\nEND:VCARD\r\n",
+	"BEGIN:VCARD\nVERSION:3.0\nN:A;B\nNOTE:line1\\nline2\n  folded\nEND:VCARD",
+};
+
+static gchar* card_string(VFormat *vformat)
+{
+	return vformat_to_string(vformat, VFORMAT_CARD_30);
+}
+
+/* feeding a card in chunks of any size gives the same card as parsing
+   it in one go, however the chunks split the line breaks and folds */
+static void test_push_parser(void)
+{
+	guint i;
+	gsize chunk, pos, len;
+
+	for(i = 0; i < G_N_ELEMENTS(test_cards); i++) {
+		VFormat *ref;
+		gchar *expected;
+
+		ref = vformat_new_from_string(test_cards[i]);
+		expected = card_string(ref);
+		len = strlen(test_cards[i]);
+
+		for(chunk = 1; chunk <= len; chunk++) {
+			VFormatParser *parser;
+			VFormat *vformat;
+			gchar *got;
+
+			parser = vformat_parser_new();
+			for(pos = 0; pos < len; pos += chunk)
+				vformat_parser_feed(parser, test_cards[i] + pos, MIN(chunk, len - pos));
+			vformat = vformat_parser_finish(parser);
+			got = card_string(vformat);
+			CHECK(strcmp(got, expected) == 0);
+			g_free(got);
+			vformat_free(vformat);
+		}
+
+		g_free(expected);
+		vformat_free(ref);
+	}
+
+	/* a parser that is dropped half way must not leak or crash */
+	{
+		VFormatParser *parser = vformat_parser_new();
+		vformat_parser_feed(parser, test_cards[0], 40);
+		vformat_parser_free(parser);
+	}
+}
+
+/* enough objects for several chunks, so the thread pool gets work.  A
+   calendar with nested components and stray lines between the objects
+   are mixed in.  Every thread count gives the objects in input order,
+   each the same as when parsed on its own. */
+static void test_bulk_parser(void)
+{
+	static const guint thread_counts[] = { 1, 4, 0 };
+	GPtrArray *objects;
+	GString *buf;
+	guint i, t;
+
+	objects = g_ptr_array_new();
+	buf = g_string_new("stray line before the first object\r\n");
+	for(i = 0; i < 3000; i++) {
+		gchar *obj;
+
+		if(i % 100 == 50)
+			obj = g_strdup_printf("BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+			                      "BEGIN:VEVENT\r\nSUMMARY:Event %u\r\nEND:VEVENT\r\n"
+			                      "BEGIN:VTODO\r\nSUMMARY:Todo %u\r\nEND:VTODO\r\n"
+			                      "END:VCALENDAR\r\n", i, i);
+		else
+			obj = g_strdup_printf("BEGIN:VCARD\r\nVERSION:2.1\r\nN:Name%u;X\r\n"
+			                      "X-CUSTOM%u:v\r\nEMAIL;INTERNET:n%u@example.org\r\n"
+			                      "END:VCARD\r\n", i, i % 50, i);
+		g_ptr_array_add(objects, obj);
+		g_string_append(buf, obj);
+		if(i % 7 == 0)
+			g_string_append(buf, "\r\n");
+	}
+
+	for(t = 0; t < G_N_ELEMENTS(thread_counts); t++) {
+		GPtrArray *formats;
+
+		formats = vformat_parse_bulk(buf->str, buf->len, thread_counts[t]);
+		CHECK(formats->len == objects->len);
+		for(i = 0; i < MIN(formats->len, objects->len); i++) {
+			VFormat *ref;
+			gchar *got, *expected;
+
+			ref = vformat_new_from_string(g_ptr_array_index(objects, i));
+			expected = card_string(ref);
+			got = card_string(g_ptr_array_index(formats, i));
+			CHECK(strcmp(got, expected) == 0);
+			g_free(got);
+			g_free(expected);
+			vformat_free(ref);
+		}
+		for(i = 0; i < formats->len; i++)
+			vformat_free(g_ptr_array_index(formats, i));
+		g_ptr_array_free(formats, TRUE);
+	}
+
+	/* nothing to parse, and a last object without its END line */
+	{
+		GPtrArray *formats;
+		const char *cut = "BEGIN:VCARD\r\nN:Cut;Off\r\n";
+
+		formats = vformat_parse_bulk("", 0, 4);
+		CHECK(formats->len == 0);
+		g_ptr_array_free(formats, TRUE);
+
+		formats = vformat_parse_bulk(cut, strlen(cut), 4);
+		CHECK(formats->len == 1);
+		CHECK(formats->len == 1 &&
+		      vformat_find_attribute(g_ptr_array_index(formats, 0), "N") != NULL);
+		for(i = 0; i < formats->len; i++)
+			vformat_free(g_ptr_array_index(formats, i));
+		g_ptr_array_free(formats, TRUE);
+	}
+
+	for(i = 0; i < objects->len; i++)
+		g_free(g_ptr_array_index(objects, i));
+	g_ptr_array_free(objects, TRUE);
+	g_string_free(buf, TRUE);
+}
+
+/* quoted-printable values are decoded in place while parsing: escapes
+   in either case, a soft line break, a broken escape kept as it is, and
+   values that a soft line break runs across */
+static void test_qp_values(void)
+{
+	static const char *card =
+		"BEGIN:VCARD\r\nVERSION:2.1\r\n"
+		"NOTE;ENCODING=QUOTED-PRINTABLE;CHARSET=UTF-8:a long literal run before it, "
+		"N=c3=bcrnberg =3D=\r\nsoft break, x=G1\r\n"
+		"ADR;ENCODING=QUOTED-PRINTABLE;CHARSET=UTF-8:;;Stra=C3=9Fe 1;Ort=\r\nteil;;12345;\r\n"
+		"END:VCARD\r\n";
+	static const char *adr[] = { "", "", "Stra\xc3\x9f" "e 1", "Ortteil", "", "12345", "" };
+	VFormat *vformat;
+	VFormatAttribute *attr;
+	guint i;
+
+	vformat = vformat_new_from_string(card);
+
+	attr = vformat_find_attribute(vformat, "NOTE");
+	CHECK(attr && vformat_attribute_get_n_values(attr) == 1);
+	if(attr)
+		CHECK(strcmp(vformat_attribute_get_nth_value(attr, 0),
+		             "a long literal run before it, N\xc3\xbcrnberg =soft break, x=G1") == 0);
+
+	attr = vformat_find_attribute(vformat, "ADR");
+	CHECK(attr && vformat_attribute_get_n_values(attr) == G_N_ELEMENTS(adr));
+	for(i = 0; attr && i < MIN(vformat_attribute_get_n_values(attr), G_N_ELEMENTS(adr)); i++)
+		CHECK(strcmp(vformat_attribute_get_nth_value(attr, i), adr[i]) == 0);
+
+	vformat_free(vformat);
+}
+
+/* the same bytes on every run */
+static guint32 random_state = 1;
+
+static guint random_below(guint n)
+{
+	random_state = random_state * 1103515245 + 12345;
+	return (random_state >> 16) % n;
+}
+
+/* every escaping variant gives the same text, only where there are
+   special characters, and unescaping gives the input back.  The
+   strings are long enough for the vector scans, with the specials at
+   changing positions.  CR is left out, escaping folds CRLF into one
+   line break. */
+static void test_escape_round_trip(void)
+{
+	static const VFormatType types[] = {
+		VFORMAT_CARD_30, VFORMAT_EVENT_10, VFORMAT_EVENT_20,
+		VFORMAT_TODO_20, VFORMAT_NOTE, VFORMAT_JOURNAL
+	};
+	static const char specials[] = ";,\\\n";
+	char in[130], buf[80];
+	guint t, len, i, iter;
+
+	for(iter = 0; iter < 2000; iter++) {
+		len = random_below(sizeof(in));
+		for(i = 0; i < len; i++) {
+			if(random_below(16) == 0)
+				in[i] = specials[random_below(sizeof(specials) - 1)];
+			else
+				in[i] = 'a' + random_below(26);
+		}
+		in[len] = '\0';
+
+		for(t = 0; t < G_N_ELEMENTS(types); t++) {
+			gchar *escaped, *unescaped;
+			GString *str;
+			gsize n;
+
+			escaped = vformat_escape_string(in, types[t]);
+			CHECK(vformat_string_needs_escape(in, -1, types[t]) == (strcmp(escaped, in) != 0));
+
+			str = g_string_new("prefix");
+			vformat_escape_string_append(str, in, len, types[t]);
+			CHECK(strcmp(str->str + strlen("prefix"), escaped) == 0);
+			g_string_free(str, TRUE);
+
+			n = vformat_escape_string_to_buffer(in, len, types[t], buf, sizeof(buf));
+			CHECK(n == strlen(escaped));
+			if(n < sizeof(buf))
+				CHECK(strcmp(buf, escaped) == 0);
+
+			unescaped = vformat_unescape_string(escaped);
+			CHECK(strcmp(unescaped, in) == 0);
+			g_free(unescaped);
+
+			n = vformat_unescape_string_to_buffer(escaped, -1, escaped);
+			CHECK(n == len && strcmp(escaped, in) == 0);
+			g_free(escaped);
+		}
+	}
+
+	/* vcard 2.1 keeps line breaks and backslashes */
+	{
+		gchar *escaped = vformat_escape_string("a\nb;c,d\\e", VFORMAT_CARD_21);
+		CHECK(strcmp(escaped, "a\r\nb\\;c,d\\e") == 0);
+		g_free(escaped);
+	}
+}
+
+/* values with special characters survive writing a card and reading
+   it back */
+static void test_escape_card(void)
+{
+	static const char *value = "line one\nline two; with, all \\ of them";
+	VFormat *vformat, *parsed;
+	VFormatAttribute *attr;
+	gchar *str;
+
+	vformat = vformat_new();
+	vformat_add_attribute_with_value(vformat, vformat_attribute_new(NULL, "NOTE"), value);
+	str = vformat_to_string(vformat, VFORMAT_CARD_30);
+	parsed = vformat_new_from_string(str);
+
+	attr = vformat_find_attribute(parsed, "NOTE");
+	CHECK(attr && vformat_attribute_get_n_values(attr) == 1);
+	if(attr)
+		CHECK(strcmp(vformat_attribute_get_nth_value(attr, 0), value) == 0);
+
+	vformat_free(parsed);
+	g_free(str);
+	vformat_free(vformat);
+}
+
+/* a card with a PHOTO of @len bytes, folded the way devices send it.
+   The base64 text is returned in @b64. */
+static gchar* photo_card(const guchar *bytes, gsize len, gchar **b64)
+{
+	GString *card;
+	gsize n, i;
+
+	*b64 = g_malloc(VFORMAT_BASE64_ENCODED_LEN(len) + 1);
+	n = vformat_base64_encode(bytes, len, *b64);
+	(*b64)[n] = '\0';
+
+	card = g_string_new("BEGIN:VCARD\r\nVERSION:3.0\r\nFN:Pic\r\nPHOTO;ENCODING=b;TYPE=JPEG:");
+	for(i = 0; i < n; i += 74) {
+		if(i)
+			g_string_append(card, "\r\n ");
+		g_string_append_len(card, *b64 + i, MIN(74, n - i));
+	}
+	g_string_append(card, "\r\nEND:VCARD\r\n");
+
+	return g_string_free(card, FALSE);
+}
+
+/* base64 values from the threshold on are kept as blobs, shorter ones
+   and any value with the threshold at 0 are not.  Blob or not, the
+   accessors and the written card give the same results. */
+static void test_blob_threshold(void)
+{
+	/* 765 bytes make 1020 base64 characters, 768 make 1024 */
+	static const struct {
+		gsize threshold;
+		gsize len;
+		gboolean blob;
+	} cases[] = {
+		{ 1024, 765, FALSE },
+		{ 1024, 768, TRUE },
+		{ 1024, 5000, TRUE },
+		{ 0, 5000, FALSE },
+	};
+	gsize default_threshold;
+	guchar bytes[5000];
+	guint c;
+	gsize i;
+
+	default_threshold = vformat_get_blob_threshold();
+	CHECK(default_threshold == 64 * 1024);
+
+	for(i = 0; i < sizeof(bytes); i++)
+		bytes[i] = random_below(256);
+
+	for(c = 0; c < G_N_ELEMENTS(cases); c++) {
+		VFormat *vformat, *reparsed;
+		VFormatAttribute *attr;
+		gchar *card, *b64, *str;
+		const guchar *blob;
+		GString *decoded;
+		gsize blob_len = 0;
+
+		card = photo_card(bytes, cases[c].len, &b64);
+
+		vformat_set_blob_threshold(cases[c].threshold);
+		CHECK(vformat_get_blob_threshold() == cases[c].threshold);
+		vformat = vformat_new_from_string(card);
+		attr = vformat_find_attribute(vformat, "PHOTO");
+		CHECK(attr != NULL);
+		if(!attr) {
+			vformat_free(vformat);
+			g_free(card);
+			g_free(b64);
+			continue;
+		}
+
+		blob = vformat_attribute_get_blob(attr, &blob_len);
+		CHECK((blob != NULL) == cases[c].blob);
+		if(blob)
+			CHECK(blob_len == cases[c].len && memcmp(blob, bytes, blob_len) == 0);
+
+		/* the decoded value of an ENCODING=b property is its base64
+		   text, blob or not */
+		decoded = vformat_attribute_get_value_decoded(attr);
+		CHECK(decoded && strcmp(decoded->str, b64) == 0);
+		if(decoded)
+			g_string_free(decoded, TRUE);
+		CHECK(strcmp(vformat_attribute_get_nth_value(attr, 0), b64) == 0);
+
+		/* written out again, the value reads back the same */
+		str = vformat_to_string(vformat, VFORMAT_CARD_30);
+		vformat_set_blob_threshold(0);
+		reparsed = vformat_new_from_string(str);
+		attr = vformat_find_attribute(reparsed, "PHOTO");
+		CHECK(attr && strcmp(vformat_attribute_get_nth_value(attr, 0), b64) == 0);
+
+		vformat_free(reparsed);
+		g_free(str);
+		vformat_free(vformat);
+		g_free(card);
+		g_free(b64);
+	}
+
+	/* only base64 values are spilled */
+	{
+		GString *card = g_string_new("BEGIN:VCARD\r\nVERSION:3.0\r\nNOTE:");
+		VFormat *vformat;
+		VFormatAttribute *attr;
+
+		for(i = 0; i < 2000; i++)
+			g_string_append_c(card, 'a' + i % 26);
+		g_string_append(card, "\r\nEND:VCARD\r\n");
+
+		vformat_set_blob_threshold(1024);
+		vformat = vformat_new_from_string(card->str);
+		attr = vformat_find_attribute(vformat, "NOTE");
+		CHECK(attr && !vformat_attribute_get_blob(attr, NULL));
+		vformat_free(vformat);
+		g_string_free(card, TRUE);
+	}
+
+	vformat_set_blob_threshold(default_threshold);
+}
+
+int main(void)
+{
+	test_push_parser();
+	test_bulk_parser();
+	test_qp_values();
+	test_escape_round_trip();
+	test_escape_card();
+	test_blob_threshold();
+
+	if(failures)
+		g_print("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}